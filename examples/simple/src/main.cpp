@@ -63,5 +63,6 @@ void setup(void)
 
 void loop()
 {
-  adapter->update();
+  // Sleep until the adapter has work to do
+  adapter->idle(adapter->update());
 }
\ No newline at end of file
@@ -3,6 +3,9 @@
 #define ARDUINOJSON_USE_LONG_LONG 1
 #include <ArduinoJson.h>
 #include "ThingProperty.h"
+#ifdef TA_TRACING
+#include "TinyTrace.h"
+#endif
 
 class ThingDevice
 {
@@ -11,6 +14,12 @@ public:
     const char **type;
     ThingDevice *next = nullptr;
     ThingProperty *firstProperty = nullptr;
+    // persisted values were restored, a thing added again keeps its live values
+    bool restored = false;
+#ifdef TA_TRACING
+    // oldest 'setProperty' not reported yet, sent with the next 'propertyStatus'
+    TinyTrace trace;
+#endif
 
     ThingDevice(const char *_id, const char **_type)
         : id(_id), type(_type) {}
@@ -42,6 +51,22 @@ public:
         firstProperty = property;
     }
 
+    /*
+     * @brief Check if any property has changed since it was last sent
+     * @return bool
+     */
+    bool hasChangedProperties()
+    {
+        ThingItem *item = this->firstProperty;
+        while (item != nullptr)
+        {
+            if (item->isChanged())
+                return true;
+            item = item->next;
+        }
+        return false;
+    }
+
     /*
      * @brief Set a property value
      * @param {String} id : property id
@@ -72,10 +97,22 @@ public:
         }
         case NUMBER:
         {
-            ThingDataValue value;
-            value.number = newValue.as<double>();
-            property->setValue(value);
-            property->changed(value);
+            signed long long scale = property->fixedScale();
+            signed long long whole = newValue.as<signed long long>();
+            if (property->isFixedPoint() && newValue.is<signed long long>() &&
+                whole <= LLONG_MAX / scale && whole >= LLONG_MIN / scale)
+            {
+                // whole numbers are scaled without going through a double,
+                // larger ones take the double path, which clamps them
+                property->setFixedValue(whole * scale);
+            }
+            else
+            {
+                ThingDataValue value;
+                value.number = newValue.as<double>();
+                property->setValue(value);
+            }
+            property->changed(property->getValue());
             break;
         }
         case INTEGER:
@@ -93,6 +130,57 @@ public:
         }
     }
 
+    /*
+     * @brief Worst-case JSON memory needed by serialize() plus the "href"
+     * the adapter adds to each description
+     * @return size_t : bytes, excluding the slot in the parent array
+     */
+    size_t descriptionCapacity()
+    {
+        size_t typeCount = 0;
+        const char **type = this->type;
+        while ((*type) != nullptr)
+        {
+            typeCount++;
+            type++;
+        }
+
+        size_t propertyCount = 0;
+        size_t propertiesCapacity = 0;
+        ThingProperty *property = this->firstProperty;
+        while (property != nullptr)
+        {
+            propertyCount++;
+            propertiesCapacity += property->descriptionCapacity();
+            property = (ThingProperty *)property->next;
+        }
+
+        // "id", "@context", "@type", "properties" and "href" members;
+        // the id is copied once as is and once inside "/things/<id>"
+        return JSON_OBJECT_SIZE(5) + (id.length() + 1) +
+               (strlen("/things/") + id.length() + 1) +
+               JSON_ARRAY_SIZE(typeCount) +
+               JSON_OBJECT_SIZE(propertyCount) + propertiesCapacity;
+    }
+
+    /*
+     * @brief Worst-case JSON memory needed to serialize every property value
+     * @return size_t : bytes, excluding the slot in the parent object
+     */
+    size_t valuesCapacity()
+    {
+        size_t propertyCount = 0;
+        size_t capacity = 0;
+        ThingItem *item = this->firstProperty;
+        while (item != nullptr)
+        {
+            propertyCount++;
+            capacity += item->valueCapacity();
+            item = item->next;
+        }
+        return JSON_OBJECT_SIZE(propertyCount) + capacity;
+    }
+
     /*
      * @brief Serialize the thing to JSON
      * @param {JsonObject} descr : JSON object to serialize to
@@ -1,6 +1,7 @@
 #pragma once
 
 #include <ArduinoJson.h>
+#include <limits.h>
 
 enum ThingDataType
 {
@@ -25,6 +26,58 @@ union ThingDataValue
 };
 typedef ThingDataValue ThingPropertyValue;
 
+/*
+ * Set whenever a property changes, so a sleeping adapter can wake up early.
+ * @return volatile bool & : the flag, shared by all properties
+ */
+inline volatile bool &thingChangedFlag()
+{
+    static volatile bool changed = false;
+    return changed;
+}
+
+/*
+ * Write a fixed-point number as text, e.g. (2315, 2) -> "23.15", using
+ * integer arithmetic only.
+ * @param char *buf : at least 24 bytes
+ * @return size_t : length of the text
+ */
+inline size_t formatFixed(char *buf, signed long long scaled, uint8_t precision)
+{
+    char digits[21];
+    size_t count = 0;
+    bool negative = scaled < 0;
+    unsigned long long magnitude = negative ? 0ULL - (unsigned long long)scaled : (unsigned long long)scaled;
+    // 64-bit division is done in software, use 32 bits once the value fits
+    while (magnitude > 0xFFFFFFFFULL)
+    {
+        digits[count++] = '0' + magnitude % 10;
+        magnitude /= 10;
+    }
+    uint32_t low = (uint32_t)magnitude;
+    do
+    {
+        digits[count++] = '0' + low % 10;
+        low /= 10;
+    } while (low > 0 || count <= precision);
+
+    size_t len = 0;
+    if (negative)
+    {
+        buf[len++] = '-';
+    }
+    while (count > 0)
+    {
+        if (count == precision)
+        {
+            buf[len++] = '.';
+        }
+        buf[len++] = digits[--count];
+    }
+    buf[len] = '\0';
+    return len;
+}
+
 /*
  * This is the base class for all properties.
  */
@@ -36,7 +89,8 @@ public:
     String atType;
     ThingItem *next = nullptr;
     String unit = "";
-
+    /* @brief keep the value across reboots (needs TA_PERSISTENCE) */
+    bool persistent = false;
     ThingItem(const char *id_, ThingDataType type_,
               const char *atType_)
         : id(id_), type(type_), atType(atType_) {}
@@ -47,8 +101,15 @@ public:
      */
     void setValue(ThingDataValue newValue)
     {
+        if (isFixedPoint())
+        {
+            setFixedValue(toFixed(newValue.number));
+            return;
+        }
         this->value = newValue;
         this->hasChanged = true;
+        this->unsaved = this->persistent;
+        thingChangedFlag() = true;
     }
 
     /*
@@ -59,6 +120,92 @@ public:
     {
         *(this->getValue().string) = s;
         this->hasChanged = true;
+        this->unsaved = this->persistent;
+        thingChangedFlag() = true;
+    }
+
+    /*
+     * @brief Set the value of a fixed-point NUMBER property
+     * @param signed long long scaled : value multiplied by 10^precision
+     */
+    void setFixedValue(signed long long scaled)
+    {
+        this->fixed = scaled;
+        this->value.number = (double)scaled / fixedScale();
+        this->hasChanged = true;
+        this->unsaved = this->persistent;
+        thingChangedFlag() = true;
+    }
+
+    /*
+     * @brief Hold a NUMBER as fixed point with the given number of decimals,
+     * the current value is rounded to it
+     * @param int8_t decimals : 0-9, -1 to hold and send it as a double
+     */
+    void setPrecision(int8_t decimals)
+    {
+        this->precision = decimals < 0 ? -1 : decimals > 9 ? 9 : decimals;
+        if (isFixedPoint())
+        {
+            this->fixed = toFixed(this->value.number);
+            this->value.number = (double)this->fixed / fixedScale();
+        }
+    }
+
+    /*
+     * @brief Decimals of a NUMBER held as fixed point
+     * @return int8_t : 0-9, -1 if it is held as a double
+     */
+    int8_t getPrecision() { return this->precision; }
+
+    /*
+     * @brief Check if the property is a NUMBER held as fixed point
+     * @return bool
+     */
+    bool isFixedPoint() { return type == NUMBER && precision >= 0; }
+
+    /*
+     * @brief Multiplier between a fixed-point value and its integer representation
+     * @return signed long long : 10^precision
+     */
+    signed long long fixedScale()
+    {
+        static const long scales[] = {1, 10, 100, 1000, 10000, 100000, 1000000,
+                                      10000000, 100000000, 1000000000};
+        return scales[precision < 0 ? 0 : precision];
+    }
+
+    /*
+     * @brief Round a number to fixed point, out of range values are clamped
+     * @param double number
+     * @return signed long long : number multiplied by 10^precision
+     */
+    signed long long toFixed(double number)
+    {
+        double scaled = number * fixedScale();
+        if (scaled != scaled)
+        {
+            return 0; // NaN
+        }
+        // (double)LLONG_MAX rounds up to 2^63, which does not fit
+        if (scaled >= (double)LLONG_MAX)
+        {
+            return LLONG_MAX;
+        }
+        if (scaled <= (double)LLONG_MIN)
+        {
+            return LLONG_MIN;
+        }
+        return (signed long long)(scaled < 0 ? scaled - 0.5 : scaled + 0.5);
+    }
+
+    /*
+     * @brief Flag the property as changed so its current value is sent again
+     */
+    void markChanged()
+    {
+        this->hasChanged = true;
+        thingChangedFlag() = true;
     }
 
     /*
@@ -72,13 +219,67 @@ public:
         return v;
     }
 
+    /*
+     * @brief Get value of a persistent property not yet written to storage, if any (and reset it)
+     * @return TinyDataValue : {boolean, number, integer, string} or NULL
+     */
+    ThingDataValue *unsavedValueOrNull()
+    {
+        ThingDataValue *v = this->unsaved ? &this->value : nullptr;
+        this->unsaved = false;
+        return v;
+    }
+
+    /*
+     * @brief Check if a persistent property has not been written to storage yet
+     * @return bool
+     */
+    bool isUnsaved() { return this->unsaved; }
+
+    /*
+     * @brief Check if the property has changed since last read (without resetting it)
+     * @return bool
+     */
+    bool isChanged() { return this->hasChanged; }
+
     /*
      * @brief Get the value of the property
      * @return TinyDataValue : {boolean, number, integer, string}
      */
     ThingDataValue getValue() { return this->value; }
 
-        /*
+    /*
+     * @brief Worst-case JSON memory needed by serialize()
+     * @return size_t : bytes, excluding the slot in the parent object
+     */
+    size_t descriptionCapacity()
+    {
+        // "type", "unit" and "@type" members; the property id is copied
+        // as the key in the parent object
+        return JSON_OBJECT_SIZE(3) + (id.length() + 1) +
+               (unit.length() + 1) + (atType.length() + 1);
+    }
+
+    /*
+     * @brief JSON memory needed by serializeValue() for the current value
+     * @return size_t : bytes, excluding the slot in the parent object
+     */
+    size_t valueCapacity()
+    {
+        size_t capacity = id.length() + 1;
+        if (type == STRING && getValue().string != nullptr)
+        {
+            capacity += getValue().string->length() + 1;
+        }
+        else if (isFixedPoint())
+        {
+            // formatFixed() text, copied as a raw value
+            capacity += 24;
+        }
+        return capacity;
+    }
+
+    /*
      * @brief Serialize the property to JSON
      * @param JsonObject &json
      * @param String deviceId
@@ -139,7 +340,16 @@ public:
             prop[this->id] = this->getValue().boolean;
             break;
         case NUMBER:
-            prop[this->id] = this->getValue().number;
+            if (isFixedPoint())
+            {
+                char buf[24];
+                size_t len = formatFixed(buf, this->fixed, precision);
+                prop[this->id] = serialized(buf, len);
+            }
+            else
+            {
+                prop[this->id] = this->getValue().number;
+            }
             break;
         case INTEGER:
             prop[this->id] = this->getValue().integer;
@@ -153,8 +363,14 @@ public:
 private:
     /* @brief stores the current state of the property */
     ThingDataValue value = {false};
+    /* @brief decimals of a NUMBER held and sent as fixed point (0-9), -1 to send it as a double */
+    int8_t precision = -1;
+    /* @brief current value of a fixed-point NUMBER, scaled by 10^precision */
+    signed long long fixed = 0;
     /* @brief stores if the property has changed since last read */
     bool hasChanged = false;
+    /* @brief stores if a persistent property has changed since last written to storage */
+    bool unsaved = false;
 };
 
 class ThingProperty : public ThingItem
@@ -164,6 +380,11 @@ private:
 
 public:
     const char **propertyEnum = nullptr;
+#ifdef TA_TRACING
+    /* @brief micros() when the callback was last entered and left */
+    unsigned long callbackStartAt = 0;
+    unsigned long callbackEndAt = 0;
+#endif
 
     ThingProperty(const char *id_, ThingDataType type_,
                   const char *atType_,
@@ -194,6 +415,34 @@ public:
         }
     }
 
+    /*
+     * @brief Worst-case JSON memory needed by serialize(), including the enum
+     * @return size_t : bytes, excluding the slot in the parent object
+     */
+    size_t descriptionCapacity()
+    {
+        size_t enumCount = 0;
+        const char **enumVal = propertyEnum;
+        while (enumVal != nullptr && *enumVal != nullptr)
+        {
+            enumCount++;
+            enumVal++;
+        }
+
+        size_t capacity = ThingItem::descriptionCapacity();
+        if (enumCount > 0)
+        {
+            capacity += JSON_OBJECT_SIZE(1) + JSON_ARRAY_SIZE(enumCount);
+        }
+        return capacity;
+    }
+
+    /*
+     * @brief Check if a callback is set
+     * @return bool
+     */
+    bool hasCallback() { return callback != nullptr; }
+
     /*
      * @brief If the property has changed, call the callback function
      * if it exists.
@@ -201,9 +450,15 @@ public:
      */
     void changed(ThingPropertyValue newValue)
     {
+#ifdef TA_TRACING
+        callbackStartAt = micros();
+#endif
         if (callback != nullptr)
         {
             callback(newValue);
         }
+#ifdef TA_TRACING
+        callbackEndAt = micros();
+#endif
     }
 };
@@ -0,0 +1,750 @@
+#pragma once
+
+#include "ThingDevice.h"
+
+#if defined(ESP8266) || defined(ESP32)
+#include <LittleFS.h>
+#else
+#include <cstdio>
+#endif
+
+// Log file holding the persisted property values
+#ifndef THING_STORE_PATH
+#define THING_STORE_PATH "/thingstore.log"
+#endif
+
+// Changes are written at most this often, bursts are coalesced into one write
+#ifndef THING_STORE_DEBOUNCE_MS
+#define THING_STORE_DEBOUNCE_MS 2000
+#endif
+
+// The log is compacted once it grows past this many bytes, or past twice
+// its size after the last compaction if that is larger
+#ifndef THING_STORE_COMPACT_SIZE
+#define THING_STORE_COMPACT_SIZE 4096
+#endif
+
+// Longest thing/property id that can be persisted
+#ifndef THING_STORE_MAX_ID_LENGTH
+#define THING_STORE_MAX_ID_LENGTH 32
+#endif
+
+#define THING_STORE_RECORD_MARKER 0xA5
+#define THING_STORE_IDLE ((unsigned long)-1)
+
+/*
+ * Thin wrapper over the file API: LittleFS on ESP8266/ESP32, stdio elsewhere
+ * (host builds).
+ */
+class ThingStoreFile
+{
+public:
+    bool open(const char *path, const char *mode)
+    {
+#if defined(ESP8266) || defined(ESP32)
+        file = LittleFS.open(path, mode);
+        return (bool)file;
+#else
+        file = fopen(path, mode);
+        return file != nullptr;
+#endif
+    }
+
+    size_t write(const uint8_t *buf, size_t len)
+    {
+#if defined(ESP8266) || defined(ESP32)
+        return file.write(buf, len);
+#else
+        return fwrite(buf, 1, len, file);
+#endif
+    }
+
+    size_t read(uint8_t *buf, size_t len)
+    {
+#if defined(ESP8266) || defined(ESP32)
+        return file.read(buf, len);
+#else
+        return fread(buf, 1, len, file);
+#endif
+    }
+
+    size_t size()
+    {
+#if defined(ESP8266) || defined(ESP32)
+        return file.size();
+#else
+        long position = ftell(file);
+        fseek(file, 0, SEEK_END);
+        long end = ftell(file);
+        fseek(file, position, SEEK_SET);
+        return end < 0 ? 0 : (size_t)end;
+#endif
+    }
+
+    void close()
+    {
+#if defined(ESP8266) || defined(ESP32)
+        file.close();
+#else
+        if (file != nullptr)
+        {
+            fclose(file);
+            file = nullptr;
+        }
+#endif
+    }
+
+    /*
+     * @brief Atomically replace `to` with `from`
+     */
+    static bool rename(const char *from, const char *to)
+    {
+#if defined(ESP8266) || defined(ESP32)
+        return LittleFS.rename(from, to);
+#else
+        return ::rename(from, to) == 0;
+#endif
+    }
+
+private:
+#if defined(ESP8266) || defined(ESP32)
+    File file;
+#else
+    FILE *file = nullptr;
+#endif
+};
+
+/*
+ * One entry of the log:
+ * [marker][type][thing id length][property id length][value length]
+ * [thing id][property id][value][crc8]
+ */
+struct ThingStoreRecord
+{
+    uint8_t type;
+    uint8_t deviceIdLength;
+    uint8_t propertyIdLength;
+    uint8_t valueLength;
+    char deviceId[THING_STORE_MAX_ID_LENGTH + 1];
+    char propertyId[THING_STORE_MAX_ID_LENGTH + 1];
+    uint8_t value[256]; // up to 255 bytes, zero terminated for STRING values
+
+    size_t size() { return 6 + deviceIdLength + propertyIdLength + valueLength; }
+};
+
+/*
+ * Persists the value of properties marked `persistent` to an append-only
+ * log. Appending never rewrites old data, and compaction writes a fresh
+ * file that replaces the old one, so flash wear is spread by the file system.
+ */
+class ThingStore
+{
+public:
+    ThingStore(const char *path_ = THING_STORE_PATH) : path(path_) {}
+
+    /*
+     * @brief Mount the file system and drop a partially written record
+     * left by a power loss.
+     * @return bool : false if the file system could not be mounted
+     */
+    bool begin()
+    {
+#if defined(ESP32)
+        // format a partition that was never used, ESP8266 does it by default
+        if (!LittleFS.begin(true))
+        {
+            return false;
+        }
+#elif defined(ESP8266)
+        if (!LittleFS.begin())
+        {
+            return false;
+        }
+#endif
+        ThingStoreFile log;
+        if (!log.open(path, "r"))
+        {
+            logSize = 0;
+            return true;
+        }
+        size_t total = log.size();
+        logSize = 0;
+        while (readRecord(log))
+        {
+            logSize += record.size();
+        }
+        log.close();
+
+        if (logSize != total)
+        {
+            truncate(logSize);
+        }
+        return true;
+    }
+
+    /*
+     * @brief Restore the last persisted value of every persistent property
+     * of the device and call its callback, so actuators match it on boot.
+     * Only done once per device: a device removed and added again keeps
+     * its live values, which are newer than the log.
+     * @param ThingDevice *device
+     */
+    void restore(ThingDevice *device)
+    {
+        if (device->restored)
+        {
+            return;
+        }
+        device->restored = true;
+
+        size_t count = 0;
+        size_t persistentCount = 0;
+        ThingProperty *property = device->firstProperty;
+        while (property != nullptr)
+        {
+            if (property->persistent && !canPersist(device, property))
+            {
+                property->persistent = false;
+            }
+            if (property->persistent)
+            {
+                persistentCount++;
+            }
+            count++;
+            property = (ThingProperty *)property->next;
+        }
+        // most things of a gateway persist nothing, don't read the log for them
+        if (persistentCount == 0)
+        {
+            return;
+        }
+
+        ThingStoreFile log;
+        if (!log.open(path, "r"))
+        {
+            return;
+        }
+        // which properties got a value, by position in the list
+        bool *restored = new bool[count]();
+        while (readRecord(log))
+        {
+            if (strcmp(record.deviceId, device->id.c_str()))
+            {
+                continue;
+            }
+            size_t index = 0;
+            property = device->firstProperty;
+            while (property != nullptr && strcmp(record.propertyId, property->id.c_str()))
+            {
+                index++;
+                property = (ThingProperty *)property->next;
+            }
+            // later records overwrite earlier ones
+            if (property != nullptr && property->persistent && applyRecord(property))
+            {
+                restored[index] = true;
+            }
+        }
+        log.close();
+
+        size_t index = 0;
+        property = device->firstProperty;
+        while (property != nullptr)
+        {
+            if (restored[index])
+            {
+                // the value came from the log, no need to write it again
+                property->unsavedValueOrNull();
+                property->changed(property->getValue());
+            }
+            index++;
+            property = (ThingProperty *)property->next;
+        }
+        delete[] restored;
+    }
+
+    /*
+     * @brief Write changed persistent properties once they settled and
+     * compact the log when it grew too large. Called from the adapter loop.
+     * @param ThingDevice *firstDevice
+     * @return unsigned long : ms until the next call has work to do,
+     * THING_STORE_IDLE if nothing is pending
+     */
+    unsigned long update(ThingDevice *firstDevice)
+    {
+        // compaction runs on the call after the write, to keep each call short
+        if (compactPending)
+        {
+            compact(firstDevice);
+            compactPending = false;
+            return THING_STORE_IDLE;
+        }
+
+        unsigned long now = millis();
+        if (!dirty)
+        {
+            if (!hasUnsavedProperties(firstDevice))
+            {
+                return THING_STORE_IDLE;
+            }
+            dirty = true;
+            dirtySince = now;
+        }
+
+        if (now - dirtySince < THING_STORE_DEBOUNCE_MS)
+        {
+            return THING_STORE_DEBOUNCE_MS - (now - dirtySince);
+        }
+
+        ThingStoreFile log;
+        if (log.open(path, "a"))
+        {
+            ThingDevice *device = firstDevice;
+            while (device != nullptr)
+            {
+                writeUnsaved(log, device);
+                device = device->next;
+            }
+            log.close();
+        }
+        dirty = false;
+        compactPending = needsCompaction();
+        return compactPending ? 0 : THING_STORE_IDLE;
+    }
+
+    /*
+     * @brief Write the changed persistent properties of one device right
+     * away, without waiting for the debounce. Used when the device is
+     * removed from the adapter, after which update() no longer sees it.
+     * @param ThingDevice *device
+     */
+    void save(ThingDevice *device)
+    {
+        ThingStoreFile log;
+        if (!log.open(path, "a"))
+        {
+            return;
+        }
+        writeUnsaved(log, device);
+        log.close();
+        compactPending = compactPending || needsCompaction();
+    }
+
+    /*
+     * @brief Rewrite the log with only the current value of each persistent
+     * property. Things that are not registered, e.g. removed ones, keep
+     * their last logged value.
+     * @param ThingDevice *firstDevice
+     */
+    void compact(ThingDevice *firstDevice)
+    {
+        String tmpPath = String(path) + ".tmp";
+        ThingStoreFile log;
+        if (!log.open(tmpPath.c_str(), "w"))
+        {
+            return;
+        }
+        size_t size = copyUnregistered(log, firstDevice);
+        ThingDevice *device = firstDevice;
+        while (device != nullptr)
+        {
+            ThingItem *item = device->firstProperty;
+            while (item != nullptr)
+            {
+                if (item->persistent)
+                {
+                    item->unsavedValueOrNull();
+                    size += writeRecord(log, device->id, item);
+                }
+                item = item->next;
+            }
+            device = device->next;
+        }
+        log.close();
+
+        if (ThingStoreFile::rename(tmpPath.c_str(), path))
+        {
+            logSize = size;
+            compactedSize = size;
+        }
+    }
+
+private:
+    const char *path;
+    size_t logSize = 0;
+    /* @brief size of the live records, as of the last compaction */
+    size_t compactedSize = 0;
+    bool dirty = false;
+    bool compactPending = false;
+    unsigned long dirtySince = 0;
+    /* @brief scratch record, kept off the stack */
+    ThingStoreRecord record;
+
+    static uint8_t crc8(uint8_t crc, const uint8_t *data, size_t len)
+    {
+        while (len--)
+        {
+            crc ^= *data++;
+            for (uint8_t i = 0; i < 8; i++)
+            {
+                crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+            }
+        }
+        return crc;
+    }
+
+    /*
+     * @brief Check if the log grew enough to be worth rewriting. Relative
+     * to the live records, so a store holding more than
+     * THING_STORE_COMPACT_SIZE of them is not rewritten on every write.
+     */
+    bool needsCompaction()
+    {
+        size_t threshold = 2 * compactedSize;
+        return logSize > (threshold > THING_STORE_COMPACT_SIZE ? threshold : THING_STORE_COMPACT_SIZE);
+    }
+
+    bool hasUnsavedProperties(ThingDevice *firstDevice)
+    {
+        ThingDevice *device = firstDevice;
+        while (device != nullptr)
+        {
+            ThingItem *item = device->firstProperty;
+            while (item != nullptr)
+            {
+                if (item->isUnsaved())
+                {
+                    return true;
+                }
+                item = item->next;
+            }
+            device = device->next;
+        }
+        return false;
+    }
+
+    /*
+     * @brief Check that a persistent property fits in a log record
+     * @return bool : false if its value can never be stored
+     */
+    bool canPersist(ThingDevice *device, ThingItem *item)
+    {
+        if (device->id.length() > THING_STORE_MAX_ID_LENGTH ||
+            item->id.length() > THING_STORE_MAX_ID_LENGTH)
+        {
+            TA_LOG("[TS:canPersist] %s/%s is not persisted, ids are limited to %d characters\n",
+                   device->id.c_str(), item->id.c_str(), THING_STORE_MAX_ID_LENGTH);
+            return false;
+        }
+        return true;
+    }
+
+    /*
+     * @brief Append the unsaved persistent values of the device to the log
+     */
+    void writeUnsaved(ThingStoreFile &log, ThingDevice *device)
+    {
+        ThingItem *item = device->firstProperty;
+        while (item != nullptr)
+        {
+            if (item->unsavedValueOrNull())
+            {
+                logSize += writeRecord(log, device->id, item);
+            }
+            item = item->next;
+        }
+    }
+
+    static bool isRegistered(ThingDevice *firstDevice, const char *deviceId)
+    {
+        ThingDevice *device = firstDevice;
+        while (device != nullptr && strcmp(device->id.c_str(), deviceId))
+        {
+            device = device->next;
+        }
+        return device != nullptr;
+    }
+
+    /*
+     * @brief Copy the last record of each property of the things that are
+     * not registered from the log to `to`
+     * @return size_t : bytes written
+     */
+    size_t copyUnregistered(ThingStoreFile &to, ThingDevice *firstDevice)
+    {
+        ThingStoreFile log;
+        if (!log.open(path, "r"))
+        {
+            return 0;
+        }
+        size_t count = 0;
+        while (readRecord(log))
+        {
+            if (!isRegistered(firstDevice, record.deviceId))
+            {
+                count++;
+            }
+        }
+        log.close();
+        if (count == 0)
+        {
+            return 0;
+        }
+
+        // position of the last record of each property, among the records
+        // of unregistered things
+        struct Key
+        {
+            String deviceId;
+            String propertyId;
+            size_t last;
+        };
+        Key *keys = new Key[count];
+        size_t keyCount = 0;
+        size_t index = 0;
+        size_t written = 0;
+        if (!log.open(path, "r"))
+        {
+            delete[] keys;
+            return 0;
+        }
+        while (readRecord(log))
+        {
+            if (isRegistered(firstDevice, record.deviceId))
+            {
+                continue;
+            }
+            size_t k = 0;
+            while (k < keyCount && (keys[k].deviceId != record.deviceId ||
+                                    keys[k].propertyId != record.propertyId))
+            {
+                k++;
+            }
+            if (k == keyCount)
+            {
+                keys[keyCount].deviceId = record.deviceId;
+                keys[keyCount].propertyId = record.propertyId;
+                keyCount++;
+            }
+            keys[k].last = index++;
+        }
+        log.close();
+
+        index = 0;
+        if (!log.open(path, "r"))
+        {
+            delete[] keys;
+            return 0;
+        }
+        while (readRecord(log))
+        {
+            if (isRegistered(firstDevice, record.deviceId))
+            {
+                continue;
+            }
+            for (size_t k = 0; k < keyCount; k++)
+            {
+                if (keys[k].last == index)
+                {
+                    written += writeBytes(to, record.type, record.deviceId, record.deviceIdLength,
+                                          record.propertyId, record.propertyIdLength,
+                                          record.value, record.valueLength);
+                    break;
+                }
+            }
+            index++;
+        }
+        log.close();
+        delete[] keys;
+        return written;
+    }
+
+    /*
+     * @brief Append the current value of the item to the log
+     * @return size_t : bytes written, 0 if the item can't be persisted
+     */
+    size_t writeRecord(ThingStoreFile &log, const String &deviceId, ThingItem *item)
+    {
+        ThingDataValue value = item->getValue();
+        const uint8_t *valueBytes;
+        size_t valueLength;
+        switch (item->type)
+        {
+        case BOOLEAN:
+            valueBytes = (const uint8_t *)&value.boolean;
+            valueLength = sizeof(value.boolean);
+            break;
+        case NUMBER:
+            valueBytes = (const uint8_t *)&value.number;
+            valueLength = sizeof(value.number);
+            break;
+        case INTEGER:
+            valueBytes = (const uint8_t *)&value.integer;
+            valueLength = sizeof(value.integer);
+            break;
+        case STRING:
+            if (value.string == nullptr)
+            {
+                return 0;
+            }
+            valueBytes = (const uint8_t *)value.string->c_str();
+            valueLength = value.string->length();
+            if (valueLength > 255)
+            {
+                TA_LOG("[TS:writeRecord] %s/%s is truncated to 255 characters\n",
+                       deviceId.c_str(), item->id.c_str());
+                valueLength = 255;
+            }
+            break;
+        default:
+            return 0;
+        }
+
+        if (deviceId.length() > THING_STORE_MAX_ID_LENGTH ||
+            item->id.length() > THING_STORE_MAX_ID_LENGTH)
+        {
+            TA_LOG("[TS:writeRecord] %s/%s is not persisted, ids are limited to %d characters\n",
+                   deviceId.c_str(), item->id.c_str(), THING_STORE_MAX_ID_LENGTH);
+            return 0;
+        }
+
+        return writeBytes(log, item->type, deviceId.c_str(), deviceId.length(),
+                          item->id.c_str(), item->id.length(), valueBytes, valueLength);
+    }
+
+    /*
+     * @brief Append a record made of the given fields to the log
+     * @return size_t : bytes written
+     */
+    size_t writeBytes(ThingStoreFile &log, uint8_t type,
+                      const char *deviceId, uint8_t deviceIdLength,
+                      const char *propertyId, uint8_t propertyIdLength,
+                      const uint8_t *value, uint8_t valueLength)
+    {
+        uint8_t header[5] = {THING_STORE_RECORD_MARKER, type,
+                             deviceIdLength, propertyIdLength, valueLength};
+        uint8_t crc = crc8(0, header + 1, 4);
+        crc = crc8(crc, (const uint8_t *)deviceId, deviceIdLength);
+        crc = crc8(crc, (const uint8_t *)propertyId, propertyIdLength);
+        crc = crc8(crc, value, valueLength);
+
+        size_t written = log.write(header, sizeof(header));
+        written += log.write((const uint8_t *)deviceId, deviceIdLength);
+        written += log.write((const uint8_t *)propertyId, propertyIdLength);
+        written += log.write(value, valueLength);
+        written += log.write(&crc, 1);
+        return written;
+    }
+
+    /*
+     * @brief Read the next record into `record`
+     * @return bool : false at the end of the log or on a corrupt record
+     */
+    bool readRecord(ThingStoreFile &log)
+    {
+        uint8_t header[5];
+        if (log.read(header, sizeof(header)) != sizeof(header) ||
+            header[0] != THING_STORE_RECORD_MARKER ||
+            header[2] > THING_STORE_MAX_ID_LENGTH ||
+            header[3] > THING_STORE_MAX_ID_LENGTH)
+        {
+            return false;
+        }
+        record.type = header[1];
+        record.deviceIdLength = header[2];
+        record.propertyIdLength = header[3];
+        record.valueLength = header[4];
+
+        uint8_t crc;
+        if (log.read((uint8_t *)record.deviceId, record.deviceIdLength) != record.deviceIdLength ||
+            log.read((uint8_t *)record.propertyId, record.propertyIdLength) != record.propertyIdLength ||
+            log.read(record.value, record.valueLength) != record.valueLength ||
+            log.read(&crc, 1) != 1)
+        {
+            return false;
+        }
+        record.deviceId[record.deviceIdLength] = '\0';
+        record.propertyId[record.propertyIdLength] = '\0';
+        record.value[record.valueLength] = '\0';
+
+        uint8_t expected = crc8(0, header + 1, 4);
+        expected = crc8(expected, (const uint8_t *)record.deviceId, record.deviceIdLength);
+        expected = crc8(expected, (const uint8_t *)record.propertyId, record.propertyIdLength);
+        expected = crc8(expected, record.value, record.valueLength);
+        return crc == expected;
+    }
+
+    /*
+     * @brief Apply the value of `record` to the property
+     * @return bool : false if the record does not match the property type
+     */
+    bool applyRecord(ThingProperty *property)
+    {
+        if (record.type != property->type)
+        {
+            return false;
+        }
+
+        ThingDataValue value = property->getValue();
+        switch (property->type)
+        {
+        case BOOLEAN:
+            if (record.valueLength != sizeof(value.boolean))
+                return false;
+            memcpy(&value.boolean, record.value, sizeof(value.boolean));
+            break;
+        case NUMBER:
+            if (record.valueLength != sizeof(value.number))
+                return false;
+            memcpy(&value.number, record.value, sizeof(value.number));
+            break;
+        case INTEGER:
+            if (record.valueLength != sizeof(value.integer))
+                return false;
+            memcpy(&value.integer, record.value, sizeof(value.integer));
+            break;
+        case STRING:
+            if (value.string == nullptr)
+                return false;
+            property->setValue((const char *)record.value);
+            return true;
+        default:
+            return false;
+        }
+        property->setValue(value);
+        return true;
+    }
+
+    /*
+     * @brief Keep only the first `size` bytes of the log
+     */
+    void truncate(size_t size)
+    {
+        String tmpPath = String(path) + ".tmp";
+        ThingStoreFile log;
+        ThingStoreFile tmp;
+        if (!log.open(path, "r"))
+        {
+            return;
+        }
+        if (!tmp.open(tmpPath.c_str(), "w"))
+        {
+            log.close();
+            return;
+        }
+        uint8_t buf[64];
+        while (size > 0)
+        {
+            size_t chunk = log.read(buf, size < sizeof(buf) ? size : sizeof(buf));
+            if (chunk == 0)
+            {
+                break;
+            }
+            tmp.write(buf, chunk);
+            size -= chunk;
+        }
+        log.close();
+        tmp.close();
+        ThingStoreFile::rename(tmpPath.c_str(), path);
+    }
+};
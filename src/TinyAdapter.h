@@ -11,37 +11,155 @@
 #define TA_LOG(...) Serial.printf(__VA_ARGS__)
 #endif
 
+#ifdef TA_PERSISTENCE
+#include "ThingStore.h"
+#endif
+
+#ifdef TA_TRACING
+#include "TinyTrace.h"
+#endif
+
 #define ARDUINOJSON_USE_LONG_LONG 1
 
-#ifndef LARGE_JSON_DOCUMENT_SIZE
-#define LARGE_JSON_DOCUMENT_SIZE 2048
+// Longest time update() asks to wait while connected, incoming messages
+// wait in the network stack until the next call
+#ifndef TA_POLL_INTERVAL_MS
+#define TA_POLL_INTERVAL_MS 50
 #endif
 
-#ifndef SMALL_JSON_DOCUMENT_SIZE
-#define SMALL_JSON_DOCUMENT_SIZE 512
+// Longest single delay() in idle(), a property changed by an interrupt
+// is noticed after at most this long
+#ifndef TA_IDLE_CHUNK_MS
+#define TA_IDLE_CHUNK_MS 100
 #endif
 
-#ifndef TINY_JSON_DOCUMENT_SIZE
-#define TINY_JSON_DOCUMENT_SIZE 256
+// Number of tunnel endpoints the adapter can fail over between
+#ifndef TA_MAX_ENDPOINTS
+#define TA_MAX_ENDPOINTS 4
 #endif
 
+// With more than one endpoint, the active one is pinged this often...
+#ifndef TA_PING_INTERVAL_MS
+#define TA_PING_INTERVAL_MS 5000
+#endif
+
+// ...and abandoned if the pong takes longer than this
+#ifndef TA_PONG_TIMEOUT_MS
+#define TA_PONG_TIMEOUT_MS 2000
+#endif
+
+// While a pong is awaited update() asks to be called again this soon, the
+// ping is measured to within this instead of TA_POLL_INTERVAL_MS
+#ifndef TA_PONG_POLL_MS
+#define TA_PONG_POLL_MS 2
+#endif
+
+// Time allowed to (re)connect to an endpoint before trying the next one
+#ifndef TA_CONNECT_TIMEOUT_MS
+#define TA_CONNECT_TIMEOUT_MS 5000
+#endif
+
+// An endpoint that failed is ranked last by preferLowestRtt for this long
+#ifndef TA_ENDPOINT_COOLDOWN_MS
+#define TA_ENDPOINT_COOLDOWN_MS 60000
+#endif
+
+#define TA_RTT_UNKNOWN ((unsigned long)-1)
+
+/*
+ * A tunnel server the adapter can connect to.
+ */
+struct TinyEndpoint
+{
+    String url;
+    int port;
+    String path;
+    // last ping round trip in ms, measured while the endpoint was active,
+    // TA_RTT_UNKNOWN if it never was
+    unsigned long rtt = TA_RTT_UNKNOWN;
+    bool failed = false;
+    unsigned long failedAt = 0;
+};
 
 class TinyAdapter
 {
 
 public:
     TinyAdapter(String _websocketUrl, int _port, String _websocketPath)
-        : websocketUrl(_websocketUrl),  port(_port), websocketPath(_websocketPath) {}
+        : websocketUrl(_websocketUrl),  port(_port), websocketPath(_websocketPath)
+    {
+        addEndpoint(_websocketUrl, _port, _websocketPath);
+    }
 
+    // Active endpoint
     String websocketUrl;   // "eg: ws://<somehost>"
     int port; // port to connect to
     String websocketPath; // "eg: /ws"
 
     // Final url -> ws://<websocketUrl>:<port><websocketPath>
 
+    TinyEndpoint endpoints[TA_MAX_ENDPOINTS];
+    uint8_t endpointCount = 0;
+    uint8_t activeEndpoint = 0;
+    // On failover pick the endpoint with the lowest ping instead of the next one
+    bool preferLowestRtt = false;
+    unsigned long failoverCount = 0;
+
     ThingDevice *firstDevice = nullptr;
     ThingDevice *lastDevice = nullptr;
     WebSocketsClient webSocket;
+    // Number of JSON documents that ran out of memory, i.e. were truncated
+    unsigned long jsonOverflowCount = 0;
+    bool connected = false;
+    unsigned long connectedAt = 0;
+    unsigned long disconnectedAt = 0;
+    unsigned long reconnectInterval = 500; // WebSocketsClient default
+    unsigned long heartbeatInterval = 0;
+    bool useSSL = false;
+    bool started = false;
+    // since when the active endpoint has been unreachable
+    unsigned long downSince = 0;
+    unsigned long pingSentAt = 0;
+    bool pingPending = false;
+    // send every property again once connected, to not lose changes made offline
+    bool resyncOnConnect = false;
+
+#ifdef TA_TRACING
+    // trace of the 'setProperty' being handled
+    TinyTrace trace;
+    unsigned long messageReceivedAt = 0;
+    // receive -> parse done
+    TinyLatencyHistogram parseLatency;
+    // callback entry -> exit
+    TinyLatencyHistogram callbackLatency;
+    // receive -> report sent
+    TinyLatencyHistogram firmwareLatency;
+    // ids are copied, the thing may be removed later
+    String slowestCallbackThingId;
+    String slowestCallbackPropertyId;
+    unsigned long slowestCallbackUs = 0;
+#endif
+
+#ifdef TA_PERSISTENCE
+    ThingStore *store = nullptr;
+
+    /*
+     * Persist properties marked `persistent` to the given store.
+     * Must be called before addDevice() for values to be restored.
+     * @param ThingStore *store
+     * @return bool : false if the store could not be opened
+     */
+    bool setStore(ThingStore *_store)
+    {
+        if (!_store->begin())
+        {
+            TA_LOG("[TA:setStore] Could not mount the file system\n");
+            return false;
+        }
+        store = _store;
+        return true;
+    }
+#endif
 
     WebSocketsClient getWebSocketClient()
     {
@@ -57,19 +175,33 @@ public:
         webSocket.sendTXT(msg.c_str(), msg.length() + 1);
     }
 
+    /*
+     * JSON memory that is always enough to parse the given text.
+     * Strings are copied out of it, so it bounds their size, and every
+     * object member takes at least 4 characters, e.g. `"":1`. Messages from
+     * the tunnel carry no arrays.
+     * @param {String} json
+     * @return size_t : bytes
+     */
+    size_t incomingCapacity(const String &json)
+    {
+        return JSON_OBJECT_SIZE(json.length() / 4 + 1) + json.length();
+    }
+
     /*
      * Handles the message received from the server.
      * @param {String} payload
      */
     void messageHandler(String payload)
     {
-        StaticJsonDocument<TINY_JSON_DOCUMENT_SIZE> doc;
+        DynamicJsonDocument doc(incomingCapacity(payload));
         DeserializationError error = deserializeJson(doc, payload);
         if (error)
         {
             TA_LOG("[TA:messageHandler] deserializeJson() failed: %s\n", error.c_str());
             String msg = "{\"messageType\":\"error\", \"errorMessage\":\"deserializeJson() failed \"}";
             sendMessage(msg);
+            return;
         }
 
         JsonObject root = doc.as<JsonObject>();
@@ -87,9 +219,22 @@ public:
             String thingId = root["thingId"];
             String propertyId = root["data"]["propertyId"];
             String data = root["data"];
+#ifdef TA_TRACING
+            trace.receivedAt = messageReceivedAt;
+            trace.hasServerSentAt = !root["sentAt"].isNull();
+            trace.serverSentAt = root["sentAt"].as<signed long long>();
+#endif
             setProperty(thingId, propertyId, data);
         }
 
+#ifdef TA_TRACING
+        else if (root["messageType"] == "getLatencyStats")
+        {
+            TA_LOG("[TA:messageHandler] Received a 'getLatencyStats' message\n");
+            getLatencyStats();
+        }
+#endif
+
         else if (root["messageType"] == "getAllThings")
         {
             TA_LOG("[TA:messageHandler] Received a 'getAllThings' message\n");
@@ -111,15 +256,34 @@ public:
         {
         case WStype_DISCONNECTED:
             TA_LOG("[TA:webSocketEvent] Disconnect!\n");
+            if (connected)
+            {
+                downSince = millis();
+                resyncOnConnect = true;
+            }
+            connected = false;
+            disconnectedAt = millis();
             break;
 
         case WStype_CONNECTED:
             TA_LOG("[TA:webSocketEvent] Connected to tunnel server!\n");
+            connected = true;
+            connectedAt = millis();
+            pingSentAt = connectedAt;
+            pingPending = false;
+            if (resyncOnConnect)
+            {
+                resyncProperties();
+                resyncOnConnect = false;
+            }
             webSocket.sendTXT("{\"messageType\":\"StartWs\"}");
             break;
 
         case WStype_TEXT:
         {
+#ifdef TA_TRACING
+            messageReceivedAt = micros();
+#endif
             TA_LOG("[TA:payloadHandler] New message received!\n");
             char msgch[length];
             for (unsigned int i = 0; i < length; i++)
@@ -158,6 +322,13 @@ public:
 
         case WStype_PONG:
             TA_LOG("[TA:webSocketEvent] Pong!\n");
+            if (pingPending)
+            {
+                unsigned long rtt = millis() - pingSentAt;
+                endpoints[activeEndpoint].rtt = rtt;
+                endpoints[activeEndpoint].failed = false;
+                pingPending = false;
+            }
             break;
         }
     }
@@ -200,6 +371,179 @@ public:
         return nullptr;
     }
 
+    /*
+     * Time between two connection attempts while disconnected.
+     * @param unsigned long interval : ms
+     */
+    void setReconnectInterval(unsigned long interval)
+    {
+        reconnectInterval = interval;
+        webSocket.setReconnectInterval(interval);
+    }
+
+    /*
+     * Ping the server periodically and drop the connection when it stops answering.
+     * @param uint32_t pingInterval : ms between pings
+     * @param uint32_t pongTimeout : ms to wait for a pong
+     * @param uint8_t disconnectTimeoutCount : missed pongs before disconnecting
+     */
+    void enableHeartbeat(uint32_t pingInterval, uint32_t pongTimeout, uint8_t disconnectTimeoutCount)
+    {
+        heartbeatInterval = pingInterval;
+        webSocket.enableHeartbeat(pingInterval, pongTimeout, disconnectTimeoutCount);
+    }
+
+    /*
+     * Add a tunnel endpoint to fail over to. The one given to the
+     * constructor is the first.
+     * @param String websocketUrl @param int websocketPort, @param String websocketPath
+     * @return bool : false if there already are TA_MAX_ENDPOINTS
+     */
+    bool addEndpoint(String _websocketUrl, int _port, String _websocketPath)
+    {
+        if (endpointCount >= TA_MAX_ENDPOINTS)
+        {
+            return false;
+        }
+        TinyEndpoint &endpoint = endpoints[endpointCount++];
+        endpoint.url = _websocketUrl;
+        endpoint.port = _port;
+        endpoint.path = _websocketPath;
+        return true;
+    }
+
+    /*
+     * Connect to the active endpoint.
+     */
+    void connect()
+    {
+        TinyEndpoint &endpoint = endpoints[activeEndpoint];
+        websocketUrl = endpoint.url;
+        port = endpoint.port;
+        websocketPath = endpoint.path;
+        // server address, port and URL
+        if (useSSL)
+        {
+            webSocket.beginSSL(websocketUrl.c_str(), port, websocketPath.c_str());
+        }
+        else
+        {
+            webSocket.begin(websocketUrl, port, websocketPath);
+        }
+        // the library connects on the next loop
+        started = true;
+        downSince = millis();
+        disconnectedAt = downSince - reconnectInterval;
+    }
+
+    /*
+     * Rank of an endpoint for preferLowestRtt, lower is better: endpoints
+     * with a measured ping first, then the ones never used, then the ones
+     * that failed less than TA_ENDPOINT_COOLDOWN_MS ago.
+     * @return uint8_t : 0, 1 or 2
+     */
+    uint8_t endpointRank(TinyEndpoint &endpoint, unsigned long now)
+    {
+        if (endpoint.failed && now - endpoint.failedAt < TA_ENDPOINT_COOLDOWN_MS)
+        {
+            return 2;
+        }
+        return endpoint.rtt == TA_RTT_UNKNOWN ? 1 : 0;
+    }
+
+    /*
+     * Drop the active endpoint and connect to the next one. With
+     * preferLowestRtt, pick the best ranked one instead, the lowest ping
+     * first. Only the active endpoint is pinged, so the ping of the
+     * others is the one measured when they were last active.
+     */
+    void failover()
+    {
+        TA_LOG("[TA:failover] Endpoint %s:%d is unreachable\n", websocketUrl.c_str(), port);
+        unsigned long now = millis();
+        endpoints[activeEndpoint].failed = true;
+        endpoints[activeEndpoint].failedAt = now;
+
+        uint8_t next = (activeEndpoint + 1) % endpointCount;
+        if (preferLowestRtt)
+        {
+            for (uint8_t i = 2; i < endpointCount; i++)
+            {
+                uint8_t candidate = (activeEndpoint + i) % endpointCount;
+                uint8_t rank = endpointRank(endpoints[candidate], now);
+                uint8_t bestRank = endpointRank(endpoints[next], now);
+                if (rank < bestRank ||
+                    (rank == bestRank && endpoints[candidate].rtt < endpoints[next].rtt))
+                {
+                    next = candidate;
+                }
+            }
+        }
+
+        webSocket.disconnect();
+        connected = false;
+        pingPending = false;
+        resyncOnConnect = true;
+        failoverCount++;
+        activeEndpoint = next;
+        connect();
+    }
+
+    /*
+     * Ping the active endpoint and fail over when it stops answering
+     * or can't be reached. Only used with more than one endpoint.
+     * @return bool : true if the adapter switched endpoint
+     */
+    bool checkEndpoint(unsigned long now)
+    {
+        if (endpointCount < 2 || !started)
+        {
+            return false;
+        }
+
+        if (!connected)
+        {
+            if (now - downSince >= TA_CONNECT_TIMEOUT_MS)
+            {
+                failover();
+                return true;
+            }
+        }
+        else if (pingPending)
+        {
+            if (now - pingSentAt >= TA_PONG_TIMEOUT_MS)
+            {
+                failover();
+                return true;
+            }
+        }
+        else if (now - pingSentAt >= TA_PING_INTERVAL_MS)
+        {
+            webSocket.sendPing();
+            pingSentAt = now;
+            pingPending = true;
+        }
+        return false;
+    }
+
+    /*
+     * Flag every property as changed so the server gets the full state.
+     */
+    void resyncProperties()
+    {
+        ThingDevice *device = this->firstDevice;
+        while (device != nullptr)
+        {
+            ThingItem *item = device->firstProperty;
+            while (item != nullptr)
+            {
+                item->markChanged();
+                item = item->next;
+            }
+            device = device->next;
+        }
+    }
+
     /*
      * Setup a unsecure websocket connection.
      * @param String websocketUrl @param int websocketPort, @param String websocketPath
@@ -207,8 +551,8 @@ public:
     void begin()
     {
 
-        // server address, port and URL
-        webSocket.begin(websocketUrl, port, websocketPath);
+        useSSL = false;
+        connect();
         // event handler
         webSocket.onEvent(std::bind(
             &TinyAdapter::webSocketEvent, this, std::placeholders::_1,
@@ -222,8 +566,8 @@ public:
     void beginSSL()
     {
 
-        // server address, port and URL
-        webSocket.beginSSL(websocketUrl.c_str(), port, websocketPath.c_str());
+        useSSL = true;
+        connect();
         // event handler
         webSocket.onEvent(std::bind(
             &TinyAdapter::webSocketEvent, this, std::placeholders::_1,
@@ -233,25 +577,111 @@ public:
     /*
      * Updates websocket connection and send changed properties to the server.
      * Note: this method should be called in the loop.
+     * @return unsigned long : ms until the next call has work to do, the
+     * loop can sleep (e.g. delay(), which allows light sleep) until then
      */
-    void update()
+    unsigned long update()
     {
 
         webSocket.loop();
+        // everything changed until now is sent below
+        thingChangedFlag() = false;
         ThingDevice *device = this->firstDevice;
         while (device != nullptr)
         {
             sendChangedProperties(device);
             device = device->next;
         }
+        unsigned long now = millis();
+        if (checkEndpoint(now))
+        {
+            // the new endpoint is connected on the next call
+            return 0;
+        }
+
+        unsigned long wait = TA_POLL_INTERVAL_MS;
+        if (connected)
+        {
+            if (heartbeatInterval > 0)
+            {
+                wait = min(wait, heartbeatInterval - (now - connectedAt) % heartbeatInterval);
+            }
+            if (endpointCount > 1)
+            {
+                unsigned long timeout = pingPending ? TA_PONG_TIMEOUT_MS : TA_PING_INTERVAL_MS;
+                wait = min(wait, timeout - (now - pingSentAt));
+                if (pingPending)
+                {
+                    wait = min(wait, (unsigned long)TA_PONG_POLL_MS);
+                }
+            }
+        }
+        else
+        {
+            // the library just retried if the interval elapsed
+            if (now - disconnectedAt >= reconnectInterval)
+            {
+                disconnectedAt = now;
+            }
+            wait = reconnectInterval - (now - disconnectedAt);
+            if (endpointCount > 1)
+            {
+                wait = min(wait, TA_CONNECT_TIMEOUT_MS - (now - downSince));
+            }
+        }
+
+#ifdef TA_PERSISTENCE
+        if (store != nullptr)
+        {
+            wait = min(wait, store->update(this->firstDevice));
+        }
+#endif
+        return wait;
+    }
+
+    /*
+     * Sleep for the time returned by update() in as few delay() calls as
+     * possible, at most TA_IDLE_CHUNK_MS each, so the chip gets long idle
+     * periods. Returns early if a property changed since update(), e.g.
+     * from a callback or an interrupt.
+     * @param unsigned long ms
+     */
+    void idle(unsigned long ms)
+    {
+        unsigned long start = millis();
+        while (!thingChangedFlag())
+        {
+            unsigned long elapsed = millis() - start;
+            if (elapsed >= ms)
+            {
+                return;
+            }
+            unsigned long left = ms - elapsed;
+            delay(left < TA_IDLE_CHUNK_MS ? left : TA_IDLE_CHUNK_MS);
+        }
     }
 
     /*
-     * Add a thing to the adapter.
+     * Add a thing to the adapter. Can be called at any time, once connected
+     * the server is notified with a 'thingAdded' message.
      * @param TinyThing* thing
+     * @return bool : false if a thing with the same id was already added
      */
-    void addDevice(ThingDevice *device)
+    bool addDevice(ThingDevice *device)
     {
+        if (findDeviceById(device->id) != nullptr)
+        {
+            TA_LOG("[TA:addDevice] A thing with id %s was already added\n", device->id.c_str());
+            return false;
+        }
+        device->next = nullptr;
+
+#ifdef TA_PERSISTENCE
+        if (store != nullptr)
+        {
+            store->restore(device);
+        }
+#endif
         if (this->lastDevice == nullptr)
         {
             this->firstDevice = device;
@@ -262,6 +692,93 @@ public:
             this->lastDevice->next = device;
             this->lastDevice = device;
         }
+
+        if (connected)
+        {
+            sendThingAdded(device);
+        }
+        return true;
+    }
+
+    /*
+     * Remove a thing from the adapter. Once connected the server is
+     * notified with a 'thingRemoved' message.
+     * @param TinyThing* thing
+     * @return bool : false if the thing was not added
+     */
+    bool removeDevice(ThingDevice *device)
+    {
+        ThingDevice *previous = nullptr;
+        ThingDevice *current = this->firstDevice;
+        while (current != nullptr && current != device)
+        {
+            previous = current;
+            current = current->next;
+        }
+        if (current == nullptr)
+        {
+            return false;
+        }
+
+        if (previous == nullptr)
+        {
+            this->firstDevice = device->next;
+        }
+        else
+        {
+            previous->next = device->next;
+        }
+        if (this->lastDevice == device)
+        {
+            this->lastDevice = previous;
+        }
+        device->next = nullptr;
+
+#ifdef TA_PERSISTENCE
+        if (store != nullptr)
+        {
+            // the store only sees registered things, write what is pending now
+            store->save(device);
+        }
+#endif
+        if (connected)
+        {
+            sendThingRemoved(device);
+        }
+        return true;
+    }
+
+    /*
+     * Worst-case JSON memory needed by the description of all things.
+     * @return size_t : bytes
+     */
+    size_t descriptionCapacity()
+    {
+        size_t deviceCount = 0;
+        size_t capacity = 0;
+        ThingDevice *device = this->firstDevice;
+        while (device != nullptr)
+        {
+            deviceCount++;
+            capacity += device->descriptionCapacity();
+            device = device->next;
+        }
+        // "messageType" and "things" members
+        return JSON_OBJECT_SIZE(2) + JSON_ARRAY_SIZE(deviceCount) + capacity;
+    }
+
+    /*
+     * Count a document that ran out of memory, its output is truncated.
+     * @param JsonDocument doc
+     * @param const char *caller
+     */
+    void checkOverflow(JsonDocument &doc, const char *caller)
+    {
+        if (doc.overflowed())
+        {
+            jsonOverflowCount++;
+            TA_LOG("[TA:%s] JSON document overflowed its %u bytes\n", caller, (unsigned int)doc.capacity());
+        }
     }
 
     /*
@@ -270,7 +787,20 @@ public:
      */
     void sendChangedProperties(ThingDevice *device)
     {
-        StaticJsonDocument<TINY_JSON_DOCUMENT_SIZE> message;
+        if (!device->hasChangedProperties())
+        {
+            return;
+        }
+
+        // "messageType", "data" and "thingId" members
+        size_t capacity = JSON_OBJECT_SIZE(3) + (device->id.length() + 1) + device->valuesCapacity();
+#ifdef TA_TRACING
+        if (device->trace.pending)
+        {
+            capacity += JSON_OBJECT_SIZE(1) + TinyTrace::capacity();
+        }
+#endif
+        DynamicJsonDocument message(capacity);
         message["messageType"] = "propertyStatus";
         JsonObject prop = message.createNestedObject("data");
         bool dataToSend = false;
@@ -289,6 +819,16 @@ public:
         {
             String jsonStr;
             message["thingId"] = device->id;
+#ifdef TA_TRACING
+            if (device->trace.pending)
+            {
+                unsigned long reportedAt = micros();
+                device->trace.serialize(message.createNestedObject("trace"), reportedAt);
+                firmwareLatency.record(reportedAt - device->trace.receivedAt);
+                device->trace.pending = false;
+            }
+#endif
+            checkOverflow(message, "sendChangedProperties");
             serializeJson(message, jsonStr);
             sendMessage(jsonStr);
         }
@@ -300,9 +840,9 @@ public:
      */
     void getThingDescription()
     {
-        // StaticJsonDocument<LARGE_JSON_DOCUMENT_SIZE> buf;
-        DynamicJsonDocument buf(LARGE_JSON_DOCUMENT_SIZE);
-        JsonArray things = buf.to<JsonArray>();
+        DynamicJsonDocument doc(descriptionCapacity());
+        doc["messageType"] = "descriptionOfThings";
+        JsonArray things = doc.createNestedArray("things");
         ThingDevice *device = this->firstDevice;
         while (device != nullptr)
         {
@@ -311,14 +851,40 @@ public:
             descr["href"] = "/things/" + device->id;
             device = device->next;
         }
-        // StaticJsonDocument<LARGE_JSON_DOCUMENT_SIZE> doc;
-        DynamicJsonDocument doc(LARGE_JSON_DOCUMENT_SIZE);
-        JsonObject doc2 = doc.to<JsonObject>();
-        doc2["messageType"] = "descriptionOfThings";
-        doc2["things"] = things;
+        checkOverflow(doc, "getThingDescription");
+        String jsonStr;
+        serializeJson(doc, jsonStr);
+        sendMessage(jsonStr);
+    }
+
+    /*
+     * Send the description of a single thing that was just added.
+     * @param ThingDevice *device
+     */
+    void sendThingAdded(ThingDevice *device)
+    {
+        // "messageType" and "thing" members
+        DynamicJsonDocument doc(JSON_OBJECT_SIZE(2) + device->descriptionCapacity());
+        doc["messageType"] = "thingAdded";
+        JsonObject descr = doc.createNestedObject("thing");
+        device->serialize(descr);
+        descr["href"] = "/things/" + device->id;
+        checkOverflow(doc, "sendThingAdded");
         String jsonStr;
-        serializeJson(doc2, jsonStr);
+        serializeJson(doc, jsonStr);
         sendMessage(jsonStr);
+        TA_LOG("[TA:sendThingAdded] Thing %s was added\n", device->id.c_str());
+    }
+
+    /*
+     * Tell the server a thing was removed.
+     * @param ThingDevice *device
+     */
+    void sendThingRemoved(ThingDevice *device)
+    {
+        String msg = "{\"messageType\":\"thingRemoved\",\"thingId\":\"" + device->id + "\"}";
+        sendMessage(msg);
+        TA_LOG("[TA:sendThingRemoved] Thing %s was removed\n", device->id.c_str());
     }
 
     /*
@@ -328,32 +894,95 @@ public:
      */
     void getProperties(String thingId)
     {
-        ThingItem *rootItem = findDeviceById(thingId)->firstProperty;
-        if (rootItem == nullptr)
+        ThingDevice *device = findDeviceById(thingId);
+        if (device == nullptr)
         {
             String msg = "{\"messageType\":\"error\",\"errorCode\":\"404\",\"errorMessage\":\"Thing not found\", \"thingId\": \"" + thingId + "\"}";
             sendMessage(msg);
+            return;
         }
 
-        StaticJsonDocument<SMALL_JSON_DOCUMENT_SIZE> doc;
-        JsonObject prop = doc.to<JsonObject>();
-        ThingItem *item = rootItem;
+        // "messageType", "thingId" and "properties" members
+        DynamicJsonDocument doc(JSON_OBJECT_SIZE(3) + (thingId.length() + 1) + device->valuesCapacity());
+        doc["messageType"] = "getProperty";
+        doc["thingId"] = thingId;
+        JsonObject prop = doc.createNestedObject("properties");
+        ThingItem *item = device->firstProperty;
         while (item != nullptr)
         {
             item->serializeValue(prop);
             item = item->next;
         }
-        StaticJsonDocument<SMALL_JSON_DOCUMENT_SIZE> finalDoc;
-        JsonObject finalProp = finalDoc.to<JsonObject>();
-        finalDoc["messageType"] = "getProperty";
-        finalDoc["thingId"] = thingId;
-        finalDoc["properties"] = prop;
+        checkOverflow(doc, "getProperties");
         String jsonStr;
-        serializeJson(finalProp, jsonStr);
+        serializeJson(doc, jsonStr);
         sendMessage(jsonStr);
         TA_LOG("[TA:getProperties] Property data was sent back.\n");
     }
 
+#ifdef TA_TRACING
+    /*
+     * Add a handled 'setProperty' to the histograms and attach its trace
+     * to the next report of the thing. Callback latency is only recorded
+     * when a callback ran. If a trace of the thing is still pending, the
+     * older one is kept: it has the longest time to report.
+     * @param ThingDevice *device
+     * @param ThingProperty *property
+     */
+    void recordTrace(ThingDevice *device, ThingProperty *property)
+    {
+        parseLatency.record(trace.parsedAt - trace.receivedAt);
+        if (property->hasCallback() && property->type != NO_STATE)
+        {
+            unsigned long callbackUs = trace.callbackEndAt - trace.callbackStartAt;
+            callbackLatency.record(callbackUs);
+            if (callbackUs >= slowestCallbackUs)
+            {
+                slowestCallbackThingId = device->id;
+                slowestCallbackPropertyId = property->id;
+                slowestCallbackUs = callbackUs;
+            }
+        }
+        // a request that changed nothing is never reported
+        if (property->isChanged() && !device->trace.pending)
+        {
+            device->trace = trace;
+            device->trace.pending = true;
+        }
+    }
+
+    /*
+     * When server asks for latency statistics this method is called.
+     * @example
+     * {
+     *   "messageType": "latencyStats",
+     *   "parse": {...}, "callback": {...}, "firmware": {...},
+     *   "slowestCallback": { "thingId": "led", "propertyId": "on", "us": 1200 }
+     * }
+     */
+    void getLatencyStats()
+    {
+        size_t capacity = JSON_OBJECT_SIZE(5) + 3 * TinyLatencyHistogram::capacity() + JSON_OBJECT_SIZE(3) +
+                          (slowestCallbackThingId.length() + 1) + (slowestCallbackPropertyId.length() + 1);
+        DynamicJsonDocument doc(capacity);
+        doc["messageType"] = "latencyStats";
+        parseLatency.serialize(doc.createNestedObject("parse"));
+        callbackLatency.serialize(doc.createNestedObject("callback"));
+        firmwareLatency.serialize(doc.createNestedObject("firmware"));
+        if (slowestCallbackPropertyId.length() > 0)
+        {
+            JsonObject slowest = doc.createNestedObject("slowestCallback");
+            slowest["thingId"] = slowestCallbackThingId;
+            slowest["propertyId"] = slowestCallbackPropertyId;
+            slowest["us"] = slowestCallbackUs;
+        }
+        checkOverflow(doc, "getLatencyStats");
+        String jsonStr;
+        serializeJson(doc, jsonStr);
+        sendMessage(jsonStr);
+    }
+#endif
+
     /*
      * Change a property value.
      * @param {String} thingId
@@ -377,7 +1006,7 @@ public:
             return;
         }
 
-        StaticJsonDocument<SMALL_JSON_DOCUMENT_SIZE> newBuffer;
+        DynamicJsonDocument newBuffer(incomingCapacity(newPropertyData));
         auto error = deserializeJson(newBuffer, newPropertyData);
 
         if (error)
@@ -388,7 +1017,16 @@ public:
         
         TA_LOG("[TA:setProperty] Property data was received. %s \n", newPropertyData.c_str());
         JsonObject newProp = newBuffer.as<JsonObject>();
+#ifdef TA_TRACING
+        trace.parsedAt = micros();
+        property->callbackStartAt = property->callbackEndAt = trace.parsedAt;
+        device->setProperty(property->id.c_str(), newProp["value"]);
+        trace.callbackStartAt = property->callbackStartAt;
+        trace.callbackEndAt = property->callbackEndAt;
+        recordTrace(device, property);
+#else
         device->setProperty(property->id.c_str(), newProp["value"]);
+#endif
         // Don't send the value back to the server
         // The update method will send the changed properties
         TA_LOG("[TA:setProperty] Property value has been set! \n");
@@ -0,0 +1,121 @@
+#pragma once
+
+#include <ArduinoJson.h>
+
+// Number of histogram buckets, bucket i counts latencies below 2^i us
+// and the last one everything slower (2^19 us is ~0.5s)
+#ifndef TA_TRACE_BUCKETS
+#define TA_TRACE_BUCKETS 20
+#endif
+
+/*
+ * Latency histogram with power-of-two microsecond buckets.
+ */
+struct TinyLatencyHistogram
+{
+    unsigned long buckets[TA_TRACE_BUCKETS] = {0};
+    unsigned long count = 0;
+    unsigned long max = 0;
+
+    /*
+     * @brief Add a latency to the histogram
+     * @param unsigned long us
+     */
+    void record(unsigned long us)
+    {
+        uint8_t bucket = 0;
+        while (bucket < TA_TRACE_BUCKETS - 1 && (us >> bucket) > 0)
+        {
+            bucket++;
+        }
+        buckets[bucket]++;
+        count++;
+        if (us > max)
+        {
+            max = us;
+        }
+    }
+
+    /*
+     * @brief Serialize the histogram to JSON
+     * @param JsonObject obj
+     * @example
+     * {
+     *   "count": 12,
+     *   "maxUs": 2100,
+     *   "buckets": [0, 0, 3, ...]
+     * }
+     */
+    void serialize(JsonObject obj)
+    {
+        obj["count"] = count;
+        obj["maxUs"] = max;
+        JsonArray counts = obj.createNestedArray("buckets");
+        for (uint8_t i = 0; i < TA_TRACE_BUCKETS; i++)
+        {
+            counts.add(buckets[i]);
+        }
+    }
+
+    /*
+     * @brief Worst-case JSON memory needed by serialize()
+     * @return size_t : bytes, excluding the slot in the parent object
+     */
+    static size_t capacity()
+    {
+        return JSON_OBJECT_SIZE(3) + JSON_ARRAY_SIZE(TA_TRACE_BUCKETS);
+    }
+};
+
+/*
+ * Timestamps of a 'setProperty' request, from the device receiving it to
+ * the resulting 'propertyStatus' being sent. Times are micros().
+ */
+struct TinyTrace
+{
+    // not reported yet, set on the copy kept by the thing
+    bool pending = false;
+    // "sentAt" of the request as given by the server, echoed back untouched
+    signed long long serverSentAt = 0;
+    bool hasServerSentAt = false;
+    unsigned long receivedAt = 0;
+    unsigned long parsedAt = 0;
+    unsigned long callbackStartAt = 0;
+    unsigned long callbackEndAt = 0;
+
+    /*
+     * @brief Serialize the trace to JSON, offsets are relative to receivedAt
+     * @param JsonObject obj
+     * @param unsigned long reportedAt : time the report is sent
+     * @example
+     * {
+     *   "sentAt": 1690000000000,
+     *   "receivedAt": 81234567,
+     *   "parseUs": 410,
+     *   "callbackStartUs": 430,
+     *   "callbackEndUs": 1250,
+     *   "reportUs": 2100
+     * }
+     */
+    void serialize(JsonObject obj, unsigned long reportedAt)
+    {
+        if (hasServerSentAt)
+        {
+            obj["sentAt"] = serverSentAt;
+        }
+        obj["receivedAt"] = receivedAt;
+        obj["parseUs"] = parsedAt - receivedAt;
+        obj["callbackStartUs"] = callbackStartAt - receivedAt;
+        obj["callbackEndUs"] = callbackEndAt - receivedAt;
+        obj["reportUs"] = reportedAt - receivedAt;
+    }
+
+    /*
+     * @brief Worst-case JSON memory needed by serialize()
+     * @return size_t : bytes, excluding the slot in the parent object
+     */
+    static size_t capacity()
+    {
+        return JSON_OBJECT_SIZE(6);
+    }
+};
@@ -0,0 +1,25 @@
+#pragma once
+
+#include <cstdio>
+
+/*
+ * Tiny assertion helpers, a test binary exits non-zero if any check failed.
+ */
+static int checkFailures = 0;
+
+#define CHECK(cond)                                                        \
+    do                                                                     \
+    {                                                                      \
+        if (!(cond))                                                       \
+        {                                                                  \
+            printf("  FAILED %s:%d: %s\n", __FILE__, __LINE__, #cond);     \
+            checkFailures++;                                               \
+        }                                                                  \
+    } while (0)
+
+#define RUN(test)                  \
+    do                             \
+    {                              \
+        printf("%s\n", #test);     \
+        test();                    \
+    } while (0)
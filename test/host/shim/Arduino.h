@@ -0,0 +1,183 @@
+#pragma once
+
+/*
+ * Minimal Arduino core for host tests: String, a simulated clock and Serial.
+ */
+
+#include <cstdarg>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <functional>
+#include <string>
+#include <algorithm>
+
+using std::max;
+using std::min;
+
+class String
+{
+public:
+    String() {}
+    String(const char *s) : str(s ? s : "") {}
+    String(const std::string &s) : str(s) {}
+    String(char c) : str(1, c) {}
+    String(int v) : str(std::to_string(v)) {}
+    String(unsigned int v) : str(std::to_string(v)) {}
+    String(long v) : str(std::to_string(v)) {}
+    String(unsigned long v) : str(std::to_string(v)) {}
+
+    const char *c_str() const { return str.c_str(); }
+    unsigned int length() const { return str.size(); }
+    bool reserve(unsigned int size)
+    {
+        str.reserve(size);
+        return true;
+    }
+    bool concat(const char *s)
+    {
+        str += s;
+        return true;
+    }
+    bool concat(const char *s, unsigned int n)
+    {
+        str.append(s, n);
+        return true;
+    }
+    bool concat(char c)
+    {
+        str += c;
+        return true;
+    }
+    bool concat(const String &s)
+    {
+        str += s.str;
+        return true;
+    }
+    String &operator+=(const String &s)
+    {
+        str += s.str;
+        return *this;
+    }
+    String &operator+=(const char *s)
+    {
+        str += s;
+        return *this;
+    }
+    String &operator+=(char c)
+    {
+        str += c;
+        return *this;
+    }
+    char operator[](unsigned int i) const { return str[i]; }
+    bool operator==(const String &s) const { return str == s.str; }
+    // like Arduino, a null pointer equals the empty string
+    bool operator==(const char *s) const { return s == nullptr ? str.empty() : str == s; }
+    bool operator!=(const String &s) const { return str != s.str; }
+    bool operator!=(const char *s) const { return !(*this == s); }
+    int indexOf(const char *s) const
+    {
+        size_t i = str.find(s);
+        return i == std::string::npos ? -1 : (int)i;
+    }
+
+private:
+    std::string str;
+};
+
+class StringSumHelper : public String
+{
+public:
+    StringSumHelper(const String &s) : String(s) {}
+};
+
+inline StringSumHelper operator+(const String &a, const String &b)
+{
+    StringSumHelper sum(a);
+    sum.concat(b);
+    return sum;
+}
+inline StringSumHelper operator+(const String &a, const char *b) { return a + String(b); }
+inline StringSumHelper operator+(const char *a, const String &b) { return String(a) + b; }
+
+/*
+ * Simulated clock: time only moves when the code under test calls delay()
+ * or a test calls sim::advance().
+ */
+namespace sim
+{
+    inline unsigned long &now()
+    {
+        static unsigned long ms = 0;
+        return ms;
+    }
+
+    // total time spent in delay(), i.e. asleep
+    inline unsigned long &slept()
+    {
+        static unsigned long ms = 0;
+        return ms;
+    }
+
+    inline unsigned long &delayCalls()
+    {
+        static unsigned long calls = 0;
+        return calls;
+    }
+
+    // runs once when the clock passes `interruptAt`, like an ISR would
+    inline std::function<void()> &interrupt()
+    {
+        static std::function<void()> isr;
+        return isr;
+    }
+
+    inline unsigned long &interruptAt()
+    {
+        static unsigned long ms = 0;
+        return ms;
+    }
+
+    inline void advance(unsigned long ms)
+    {
+        now() += ms;
+        if (interrupt() && now() >= interruptAt())
+        {
+            std::function<void()> isr = interrupt();
+            interrupt() = nullptr;
+            isr();
+        }
+    }
+
+    inline void reset()
+    {
+        now() = 0;
+        slept() = 0;
+        delayCalls() = 0;
+        interrupt() = nullptr;
+    }
+}
+
+inline unsigned long millis() { return sim::now(); }
+inline unsigned long micros() { return sim::now() * 1000; }
+inline void delay(unsigned long ms)
+{
+    sim::slept() += ms;
+    sim::delayCalls()++;
+    sim::advance(ms);
+}
+inline void yield() {}
+
+struct HostSerial
+{
+    int printf(const char *format, ...)
+    {
+        va_list args;
+        va_start(args, format);
+        int n = vprintf(format, args);
+        va_end(args);
+        return n;
+    }
+};
+static HostSerial Serial __attribute__((unused));
@@ -0,0 +1,169 @@
+#pragma once
+
+/*
+ * Stand-in for the WebSockets library. Connections go to FakeTunnel
+ * objects registered by the test instead of the network.
+ */
+
+#include <Arduino.h>
+#include <vector>
+
+typedef enum
+{
+    WStype_ERROR,
+    WStype_DISCONNECTED,
+    WStype_CONNECTED,
+    WStype_TEXT,
+    WStype_BIN,
+    WStype_FRAGMENT_TEXT_START,
+    WStype_FRAGMENT_BIN_START,
+    WStype_FRAGMENT,
+    WStype_FRAGMENT_FIN,
+    WStype_PING,
+    WStype_PONG,
+} WStype_t;
+
+/*
+ * A local tunnel server. When `up` is false it accepts no connection and
+ * answers no ping, but an open connection is not closed (a hung node).
+ */
+struct FakeTunnel
+{
+    String host;
+    int port;
+    bool up = true;
+    unsigned long rtt = 10;
+    std::vector<String> received;
+
+    FakeTunnel(const char *host_, int port_) : host(host_), port(port_)
+    {
+        all().push_back(this);
+    }
+    ~FakeTunnel()
+    {
+        all().erase(std::find(all().begin(), all().end(), this));
+    }
+
+    static std::vector<FakeTunnel *> &all()
+    {
+        static std::vector<FakeTunnel *> tunnels;
+        return tunnels;
+    }
+
+    static FakeTunnel *find(const String &host, int port)
+    {
+        for (FakeTunnel *tunnel : all())
+        {
+            if (tunnel->host == host && tunnel->port == port)
+            {
+                return tunnel;
+            }
+        }
+        return nullptr;
+    }
+};
+
+class WebSocketsClient
+{
+public:
+    typedef std::function<void(WStype_t type, uint8_t *payload, size_t length)> WebSocketClientEvent;
+
+    // simulated time one loop() call takes
+    unsigned long loopCost = 1;
+
+    void begin(String host, uint16_t port, String url = "/", String protocol = "arduino")
+    {
+        this->host = host;
+        this->port = port;
+        connected = false;
+        pongPending = false;
+        lastAttempt = millis() - reconnectInterval;
+    }
+
+    void beginSSL(const char *host, uint16_t port, const char *url = "/", const char *fingerprint = "", const char *protocol = "arduino")
+    {
+        begin(host, port, url);
+    }
+
+    void onEvent(WebSocketClientEvent cbEvent) { event = cbEvent; }
+
+    void setReconnectInterval(unsigned long interval) { reconnectInterval = interval; }
+
+    void enableHeartbeat(uint32_t pingInterval, uint32_t pongTimeout, uint8_t disconnectTimeoutCount) {}
+
+    void loop()
+    {
+        sim::advance(loopCost);
+        FakeTunnel *tunnel = FakeTunnel::find(host, port);
+        if (!connected)
+        {
+            if (millis() - lastAttempt >= reconnectInterval)
+            {
+                lastAttempt = millis();
+                if (tunnel != nullptr && tunnel->up)
+                {
+                    connected = true;
+                    emit(WStype_CONNECTED);
+                }
+            }
+            return;
+        }
+        if (pongPending && tunnel != nullptr && tunnel->up && millis() >= pongAt)
+        {
+            pongPending = false;
+            emit(WStype_PONG);
+        }
+    }
+
+    void disconnect()
+    {
+        if (connected)
+        {
+            connected = false;
+            emit(WStype_DISCONNECTED);
+        }
+    }
+
+    bool sendTXT(const char *payload, size_t length = 0)
+    {
+        FakeTunnel *tunnel = FakeTunnel::find(host, port);
+        if (!connected || tunnel == nullptr || !tunnel->up)
+        {
+            return false;
+        }
+        tunnel->received.push_back(payload);
+        return true;
+    }
+
+    bool sendPing(uint8_t *payload = nullptr, size_t length = 0)
+    {
+        FakeTunnel *tunnel = FakeTunnel::find(host, port);
+        if (!connected || tunnel == nullptr)
+        {
+            return false;
+        }
+        pongPending = true;
+        pongAt = millis() + tunnel->rtt;
+        return true;
+    }
+
+    bool isConnected() { return connected; }
+
+private:
+    String host;
+    uint16_t port = 0;
+    bool connected = false;
+    unsigned long reconnectInterval = 500;
+    unsigned long lastAttempt = 0;
+    bool pongPending = false;
+    unsigned long pongAt = 0;
+    WebSocketClientEvent event;
+
+    void emit(WStype_t type)
+    {
+        if (event)
+        {
+            event(type, nullptr, 0);
+        }
+    }
+};
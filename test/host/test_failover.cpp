@@ -0,0 +1,168 @@
+/*
+ * Failover between two or more local tunnel stand-ins on a simulated clock.
+ */
+#define TA_ENDPOINT_COOLDOWN_MS 30000
+
+#include <Arduino.h>
+#include <Thing.h>
+#include <TinyAdapter.h>
+#include "check.h"
+
+const char *lampTypes[] = {"Light", nullptr};
+
+// run the sketch loop until `done` or `timeout` ms passed, return the time taken
+template <typename Done>
+unsigned long runUntil(TinyAdapter &adapter, unsigned long timeout, Done done)
+{
+    unsigned long start = millis();
+    while (!done() && millis() - start < timeout)
+    {
+        adapter.idle(adapter.update());
+    }
+    return millis() - start;
+}
+
+bool isActive(TinyAdapter &adapter, FakeTunnel &tunnel)
+{
+    return adapter.connected && adapter.websocketUrl == tunnel.host && adapter.port == tunnel.port;
+}
+
+void testPongTimeoutFailsOver()
+{
+    sim::reset();
+    FakeTunnel first("tunnel-1", 443);
+    FakeTunnel second("tunnel-2", 443);
+    first.rtt = 10;
+
+    TinyAdapter adapter("tunnel-1", 443, "/ws");
+    adapter.addEndpoint("tunnel-2", 443, "/ws");
+    ThingDevice lamp("lamp", lampTypes);
+    ThingProperty level("level", INTEGER, "LevelProperty");
+    lamp.addProperty(&level);
+    adapter.addDevice(&lamp);
+    adapter.begin();
+
+    runUntil(adapter, 1000, [&]()
+             { return isActive(adapter, first); });
+    CHECK(isActive(adapter, first));
+
+    ThingDataValue value;
+    value.integer = 42;
+    level.setValue(value);
+    runUntil(adapter, TA_PING_INTERVAL_MS + 100, [&]()
+             { return adapter.endpoints[0].rtt != TA_RTT_UNKNOWN; });
+    // measured to within TA_PONG_POLL_MS plus the time of a loop() call
+    CHECK(adapter.endpoints[0].rtt >= 10 && adapter.endpoints[0].rtt <= 10 + TA_PONG_POLL_MS + 1);
+
+    // the node hangs: the socket stays open but nothing answers
+    first.up = false;
+    unsigned long took = runUntil(adapter, 60000, [&]()
+                                  { return isActive(adapter, second); });
+    printf("  failed over in %lu ms\n", took);
+    CHECK(isActive(adapter, second));
+    CHECK(adapter.failoverCount == 1);
+    CHECK(took <= TA_PING_INTERVAL_MS + TA_PONG_TIMEOUT_MS + 2 * TA_POLL_INTERVAL_MS + 10);
+
+    // the value survived and was sent again to the new tunnel
+    CHECK(level.getValue().integer == 42);
+    CHECK(!level.isChanged());
+    bool resent = false;
+    for (const String &message : second.received)
+    {
+        resent |= message.indexOf("propertyStatus") >= 0 && message.indexOf("\"level\":42") >= 0;
+    }
+    CHECK(resent);
+}
+
+void testConnectTimeoutFailsOver()
+{
+    sim::reset();
+    FakeTunnel first("tunnel-1", 443);
+    FakeTunnel second("tunnel-2", 443);
+    first.up = false;
+
+    TinyAdapter adapter("tunnel-1", 443, "/ws");
+    adapter.addEndpoint("tunnel-2", 443, "/ws");
+    adapter.begin();
+
+    unsigned long took = runUntil(adapter, 60000, [&]()
+                                  { return isActive(adapter, second); });
+    printf("  connected to the second endpoint after %lu ms\n", took);
+    CHECK(isActive(adapter, second));
+    CHECK(took <= TA_CONNECT_TIMEOUT_MS + TA_POLL_INTERVAL_MS + 10);
+}
+
+void testSingleEndpointNeverPings()
+{
+    sim::reset();
+    FakeTunnel only("tunnel-1", 443);
+    TinyAdapter adapter("tunnel-1", 443, "/ws");
+    adapter.begin();
+
+    runUntil(adapter, 3 * TA_PING_INTERVAL_MS, []()
+             { return false; });
+    only.up = false;
+    runUntil(adapter, 3 * TA_PING_INTERVAL_MS, []()
+             { return false; });
+    CHECK(adapter.endpoints[0].rtt == TA_RTT_UNKNOWN);
+    CHECK(adapter.failoverCount == 0);
+}
+
+void testPreferLowestRttRanksMeasuredFirst()
+{
+    sim::reset();
+    FakeTunnel a("tunnel-a", 443);
+    FakeTunnel b("tunnel-b", 443);
+    FakeTunnel c("tunnel-c", 443);
+    FakeTunnel d("tunnel-d", 443);
+    a.rtt = 40;
+    b.rtt = 10;
+    c.rtt = 50;
+
+    TinyAdapter adapter("tunnel-a", 443, "/ws");
+    adapter.addEndpoint("tunnel-b", 443, "/ws");
+    adapter.addEndpoint("tunnel-c", 443, "/ws");
+    adapter.addEndpoint("tunnel-d", 443, "/ws");
+    adapter.preferLowestRtt = true;
+    adapter.begin();
+
+    // A measured, then fails: B, C and D were never used, B comes first
+    runUntil(adapter, TA_PING_INTERVAL_MS + 500, [&]()
+             { return adapter.endpoints[0].rtt != TA_RTT_UNKNOWN; });
+    a.up = false;
+    runUntil(adapter, 60000, [&]()
+             { return isActive(adapter, b); });
+    CHECK(isActive(adapter, b));
+
+    // B measured, then fails: A failed recently, so C is next
+    runUntil(adapter, TA_PING_INTERVAL_MS + 500, [&]()
+             { return adapter.endpoints[1].rtt != TA_RTT_UNKNOWN; });
+    a.up = true;
+    b.up = false;
+    runUntil(adapter, 60000, [&]()
+             { return isActive(adapter, c); });
+    CHECK(isActive(adapter, c));
+
+    // C fails once A and B cooled down: B has the lowest ping and is
+    // preferred over A, and over D which was never measured
+    b.up = true;
+    runUntil(adapter, TA_PING_INTERVAL_MS + 500, [&]()
+             { return adapter.endpoints[2].rtt != TA_RTT_UNKNOWN; });
+    runUntil(adapter, TA_ENDPOINT_COOLDOWN_MS, []()
+             { return false; });
+    c.up = false;
+    runUntil(adapter, 60000, [&]()
+             { return adapter.activeEndpoint != 2; });
+    CHECK(adapter.activeEndpoint == 1);
+    printf("  rtt a=%lu b=%lu c=%lu, picked %s\n", adapter.endpoints[0].rtt,
+           adapter.endpoints[1].rtt, adapter.endpoints[2].rtt, adapter.websocketUrl.c_str());
+}
+
+int main()
+{
+    RUN(testPongTimeoutFailsOver);
+    RUN(testConnectTimeoutFailsOver);
+    RUN(testSingleEndpointNeverPings);
+    RUN(testPreferLowestRttRanksMeasuredFirst);
+    return checkFailures == 0 ? 0 : 1;
+}
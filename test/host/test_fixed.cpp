@@ -0,0 +1,122 @@
+/*
+ * Fixed-point NUMBER properties: formatting, rounding and clamping.
+ */
+#include <Arduino.h>
+#include <Thing.h>
+#include <math.h>
+#include "check.h"
+
+const char *sensorTypes[] = {"TemperatureSensor", nullptr};
+
+bool formatsAs(signed long long scaled, uint8_t precision, const char *expected)
+{
+    char buf[24];
+    size_t len = formatFixed(buf, scaled, precision);
+    if (strcmp(buf, expected) || len != strlen(expected))
+    {
+        printf("  formatFixed(%lld, %d) gave \"%s\"\n", scaled, precision, buf);
+        return false;
+    }
+    return true;
+}
+
+double scaledTo(ThingProperty &property, double number)
+{
+    ThingDataValue value;
+    value.number = number;
+    property.setValue(value);
+    return property.getValue().number;
+}
+
+void testFormat()
+{
+    CHECK(formatsAs(2315, 2, "23.15"));
+    CHECK(formatsAs(-2315, 2, "-23.15"));
+    CHECK(formatsAs(5, 2, "0.05"));
+    CHECK(formatsAs(-5, 2, "-0.05"));
+    CHECK(formatsAs(-50, 2, "-0.50"));
+    CHECK(formatsAs(0, 2, "0.00"));
+    CHECK(formatsAs(0, 0, "0"));
+    CHECK(formatsAs(-7, 0, "-7"));
+    CHECK(formatsAs(123456789012LL, 3, "123456789.012"));
+    CHECK(formatsAs(LLONG_MAX, 0, "9223372036854775807"));
+    CHECK(formatsAs(LLONG_MIN, 0, "-9223372036854775808"));
+    CHECK(formatsAs(LLONG_MIN, 9, "-9223372036.854775808"));
+}
+
+void testRounding()
+{
+    ThingProperty temperature("temperature", NUMBER, "TemperatureProperty");
+    temperature.setPrecision(2);
+    CHECK(scaledTo(temperature, 23.456) == 23.46);
+    CHECK(scaledTo(temperature, -0.005) == -0.01);
+    CHECK(scaledTo(temperature, -0.004) == 0);
+
+    temperature.setPrecision(0);
+    CHECK(temperature.getPrecision() == 0);
+    CHECK(scaledTo(temperature, 2.5) == 3);
+    CHECK(scaledTo(temperature, -2.5) == -3);
+}
+
+void testClamping()
+{
+    ThingProperty temperature("temperature", NUMBER, "TemperatureProperty");
+    temperature.setPrecision(2);
+    CHECK(temperature.toFixed(1e30) == LLONG_MAX);
+    CHECK(temperature.toFixed(-1e30) == LLONG_MIN);
+    CHECK(temperature.toFixed(9.3e16) == LLONG_MAX);
+    CHECK(temperature.toFixed(NAN) == 0);
+    CHECK(temperature.toFixed(INFINITY) == LLONG_MAX);
+    CHECK(temperature.toFixed(-INFINITY) == LLONG_MIN);
+    CHECK(scaledTo(temperature, NAN) == 0);
+
+    temperature.setPrecision(12);
+    CHECK(temperature.getPrecision() == 9);
+    temperature.setPrecision(-3);
+    CHECK(temperature.getPrecision() == -1);
+    CHECK(!temperature.isFixedPoint());
+}
+
+void testSetPrecisionRescales()
+{
+    ThingProperty temperature("temperature", NUMBER, "TemperatureProperty");
+    scaledTo(temperature, 23.456);
+    temperature.setPrecision(1);
+    CHECK(temperature.getValue().number == 23.5);
+
+    DynamicJsonDocument doc(256);
+    temperature.serializeValue(doc.to<JsonObject>());
+    String json;
+    serializeJson(doc, json);
+    CHECK(json == "{\"temperature\":23.5}");
+}
+
+void testWholeNumberOverflow()
+{
+    ThingDevice sensor("sensor", sensorTypes);
+    ThingProperty temperature("temperature", NUMBER, "TemperatureProperty");
+    temperature.setPrecision(3);
+    sensor.addProperty(&temperature);
+
+    DynamicJsonDocument doc(256);
+    deserializeJson(doc, "{\"small\":-42,\"large\":9223372036854775807,\"low\":-9223372036854775807}");
+
+    sensor.setProperty("temperature", doc["small"]);
+    CHECK(temperature.getValue().number == -42);
+
+    // LLONG_MAX / 1000 is exceeded, the value is clamped instead of wrapping
+    sensor.setProperty("temperature", doc["large"]);
+    CHECK(temperature.getValue().number > 9.2e15);
+    sensor.setProperty("temperature", doc["low"]);
+    CHECK(temperature.getValue().number < -9.2e15);
+}
+
+int main()
+{
+    RUN(testFormat);
+    RUN(testRounding);
+    RUN(testClamping);
+    RUN(testSetPrecisionRescales);
+    RUN(testWholeNumberOverflow);
+    return checkFailures == 0 ? 0 : 1;
+}
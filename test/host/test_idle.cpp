@@ -0,0 +1,144 @@
+/*
+ * Duty cycle of the update()/idle() loop on a simulated clock, and waking
+ * up when a property changes while asleep.
+ */
+#include <Arduino.h>
+#include <Thing.h>
+#include <TinyAdapter.h>
+#include "check.h"
+
+const char *lampTypes[] = {"Light", nullptr};
+
+struct Loop
+{
+    unsigned long updates = 0;
+
+    // run the sketch loop for `ms` of simulated time
+    void run(TinyAdapter &adapter, unsigned long ms)
+    {
+        unsigned long end = millis() + ms;
+        while (millis() < end)
+        {
+            adapter.idle(adapter.update());
+            updates++;
+        }
+    }
+};
+
+double dutyCycle(unsigned long sleptBefore, unsigned long start)
+{
+    unsigned long total = millis() - start;
+    unsigned long slept = sim::slept() - sleptBefore;
+    return (double)(total - slept) / total;
+}
+
+void testDisconnectedSleepsUntilReconnect()
+{
+    sim::reset();
+    TinyAdapter adapter("nowhere", 1, "/ws");
+    adapter.setReconnectInterval(5000);
+    adapter.begin();
+
+    Loop loop;
+    loop.run(adapter, 60000);
+    double duty = dutyCycle(0, 0);
+    printf("  disconnected: %lu updates, %lu delays, duty cycle %.3f%%\n",
+           loop.updates, sim::delayCalls(), duty * 100);
+    // one update per reconnect attempt
+    CHECK(loop.updates <= 60000 / 5000 + 1);
+    CHECK(duty < 0.001);
+}
+
+void testConnectedPollsAtInterval()
+{
+    sim::reset();
+    FakeTunnel tunnel("tunnel", 443);
+    TinyAdapter adapter("tunnel", 443, "/ws");
+    ThingDevice lamp("lamp", lampTypes);
+    ThingProperty on("on", BOOLEAN, "OnOffProperty");
+    lamp.addProperty(&on);
+    adapter.addDevice(&lamp);
+    adapter.begin();
+
+    Loop warmup;
+    warmup.run(adapter, 100);
+    CHECK(adapter.connected);
+
+    unsigned long start = millis();
+    unsigned long sleptBefore = sim::slept();
+    unsigned long delaysBefore = sim::delayCalls();
+    Loop loop;
+    loop.run(adapter, 60000);
+    double duty = dutyCycle(sleptBefore, start);
+    unsigned long delays = sim::delayCalls() - delaysBefore;
+    printf("  connected: %lu updates, %lu delays, duty cycle %.3f%%\n",
+           loop.updates, delays, duty * 100);
+    // a single delay() per idle(), no polling in between
+    CHECK(delays <= loop.updates);
+    CHECK(loop.updates <= 60000 / TA_POLL_INTERVAL_MS + 1);
+    // 1ms of work per TA_POLL_INTERVAL_MS
+    CHECK(duty < 2.0 / TA_POLL_INTERVAL_MS);
+}
+
+void testPropertyChangeWakesIdle()
+{
+    sim::reset();
+    TinyAdapter adapter("nowhere", 1, "/ws");
+    ThingDevice lamp("lamp", lampTypes);
+    ThingProperty on("on", BOOLEAN, "OnOffProperty");
+    lamp.addProperty(&on);
+    adapter.addDevice(&lamp);
+    adapter.setReconnectInterval(5000);
+    adapter.begin();
+
+    unsigned long wait = adapter.update();
+    CHECK(wait > 1000);
+
+    unsigned long start = millis();
+    sim::interruptAt() = start + 1234;
+    sim::interrupt() = [&on]()
+    {
+        ThingDataValue value;
+        value.boolean = true;
+        on.setValue(value);
+    };
+    adapter.idle(wait);
+    unsigned long slept = millis() - start;
+    printf("  woke up after %lu of %lu ms\n", slept, wait);
+    CHECK(on.isChanged());
+    CHECK(slept >= 1234);
+    CHECK(slept <= 1234 + TA_IDLE_CHUNK_MS);
+}
+
+void testChangeBeforeIdleSkipsSleep()
+{
+    sim::reset();
+    TinyAdapter adapter("nowhere", 1, "/ws");
+    ThingDevice lamp("lamp", lampTypes);
+    ThingProperty on("on", BOOLEAN, "OnOffProperty");
+    lamp.addProperty(&on);
+    adapter.addDevice(&lamp);
+    adapter.begin();
+
+    unsigned long wait = adapter.update();
+    ThingDataValue value;
+    value.boolean = true;
+    on.setValue(value);
+    unsigned long delays = sim::delayCalls();
+    adapter.idle(wait);
+    CHECK(sim::delayCalls() == delays);
+
+    // update() sends the change and clears the flag, the next idle() sleeps
+    wait = adapter.update();
+    adapter.idle(wait);
+    CHECK(sim::delayCalls() > delays);
+}
+
+int main()
+{
+    RUN(testDisconnectedSleepsUntilReconnect);
+    RUN(testConnectedPollsAtInterval);
+    RUN(testPropertyChangeWakesIdle);
+    RUN(testChangeBeforeIdleSkipsSleep);
+    return checkFailures == 0 ? 0 : 1;
+}
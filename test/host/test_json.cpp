@@ -0,0 +1,87 @@
+/*
+ * Messages are sized from the things they describe and never overflow.
+ */
+#include <Arduino.h>
+#include <Thing.h>
+#include <TinyAdapter.h>
+#include "check.h"
+
+const char *stationTypes[] = {"TemperatureSensor", "MultiLevelSensor", nullptr};
+const char *modes[] = {"auto", "manual", "off", nullptr};
+
+bool received(FakeTunnel &tunnel, const char *text)
+{
+    for (const String &message : tunnel.received)
+    {
+        if (message.indexOf(text) >= 0)
+        {
+            return true;
+        }
+    }
+    return false;
+}
+
+void testThingSerializesWithoutOverflow()
+{
+    sim::reset();
+    FakeTunnel tunnel("tunnel-1", 443);
+    TinyAdapter adapter("tunnel-1", 443, "/ws");
+    adapter.begin();
+    while (!adapter.connected && millis() < 1000)
+    {
+        adapter.update();
+    }
+    CHECK(adapter.connected);
+
+    ThingDevice station("weather-station", stationTypes);
+    ThingProperty temperature("temperature", NUMBER, "TemperatureProperty");
+    temperature.unit = "degree celsius";
+    temperature.setPrecision(2);
+    ThingProperty humidity("humidity", NUMBER, "LevelProperty");
+    humidity.unit = "percent";
+    ThingProperty mode("mode", STRING, "ModeProperty");
+    String modeValue = "auto";
+    ThingDataValue value;
+    value.string = &modeValue;
+    mode.setValue(value);
+    mode.propertyEnum = modes;
+    ThingProperty label("label", STRING, "LabelProperty");
+    String labelValue = "";
+    value.string = &labelValue;
+    label.setValue(value);
+    station.addProperty(&temperature);
+    station.addProperty(&humidity);
+    station.addProperty(&mode);
+    station.addProperty(&label);
+    adapter.addDevice(&station);
+
+    value.number = -1234567.891;
+    temperature.setValue(value);
+    value.number = 1.0 / 3;
+    humidity.setValue(value);
+    // far longer than any fixed default, e.g. as set by the server
+    String longLabel;
+    for (int i = 0; i < 50; i++)
+    {
+        longLabel += "0123456789";
+    }
+    label.setValue(longLabel.c_str());
+
+    adapter.update();
+    adapter.getThingDescription();
+    adapter.getProperties("weather-station");
+    CHECK(adapter.jsonOverflowCount == 0);
+
+    CHECK(received(tunnel, "\"thingAdded\""));
+    CHECK(received(tunnel, "\"descriptionOfThings\""));
+    CHECK(received(tunnel, "\"degree celsius\""));
+    CHECK(received(tunnel, "[\"auto\",\"manual\",\"off\"]"));
+    CHECK(received(tunnel, "-1234567.89"));
+    CHECK(received(tunnel, longLabel.c_str()));
+}
+
+int main()
+{
+    RUN(testThingSerializesWithoutOverflow);
+    return checkFailures == 0 ? 0 : 1;
+}
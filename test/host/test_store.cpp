@@ -0,0 +1,326 @@
+/*
+ * Persistence of property values across removing and adding things.
+ */
+#define TA_PERSISTENCE
+
+#include <Arduino.h>
+#include <Thing.h>
+#include <TinyAdapter.h>
+#include "check.h"
+#include <vector>
+
+#define STORE_PATH "test_store.log"
+
+const char *lampTypes[] = {"Light", nullptr};
+int callbacks = 0;
+
+void countCallback(ThingPropertyValue) { callbacks++; }
+
+void setLevel(ThingProperty &property, int level)
+{
+    ThingDataValue value;
+    value.integer = level;
+    property.setValue(value);
+}
+
+// run the adapter past the store debounce
+void settle(TinyAdapter &adapter)
+{
+    for (int i = 0; i < 3; i++)
+    {
+        sim::advance(THING_STORE_DEBOUNCE_MS);
+        adapter.update();
+    }
+}
+
+long fileSize(const char *path)
+{
+    FILE *file = fopen(path, "r");
+    if (file == nullptr)
+    {
+        return -1;
+    }
+    fseek(file, 0, SEEK_END);
+    long size = ftell(file);
+    fclose(file);
+    return size;
+}
+
+// append a record in the log format, see ThingStoreRecord
+void appendRecord(uint8_t type, const char *deviceId, const char *propertyId,
+                  const void *value, uint8_t valueLength, size_t keep = (size_t)-1)
+{
+    uint8_t bytes[300];
+    size_t size = 0;
+    bytes[size++] = THING_STORE_RECORD_MARKER;
+    bytes[size++] = type;
+    bytes[size++] = strlen(deviceId);
+    bytes[size++] = strlen(propertyId);
+    bytes[size++] = valueLength;
+    memcpy(bytes + size, deviceId, strlen(deviceId));
+    size += strlen(deviceId);
+    memcpy(bytes + size, propertyId, strlen(propertyId));
+    size += strlen(propertyId);
+    memcpy(bytes + size, value, valueLength);
+    size += valueLength;
+    uint8_t crc = 0;
+    for (size_t i = 1; i < size; i++)
+    {
+        crc ^= bytes[i];
+        for (int bit = 0; bit < 8; bit++)
+        {
+            crc = (crc & 0x80) ? (crc << 1) ^ 0x07 : crc << 1;
+        }
+    }
+    bytes[size++] = crc;
+
+    FILE *log = fopen(STORE_PATH, "a");
+    fwrite(bytes, 1, size < keep ? size : keep, log);
+    fclose(log);
+}
+
+void appendLevel(const char *deviceId, signed long long level, size_t keep = (size_t)-1)
+{
+    appendRecord(INTEGER, deviceId, "level", &level, sizeof(level), keep);
+}
+
+// level of the lamp as restored by a freshly booted adapter
+int restoredLevel(const char *id)
+{
+    ThingStore store(STORE_PATH);
+    TinyAdapter adapter("tunnel-1", 443, "/ws");
+    ThingDevice lamp(id, lampTypes);
+    ThingProperty level("level", INTEGER, "LevelProperty");
+    level.persistent = true;
+    lamp.addProperty(&level);
+    adapter.setStore(&store);
+    adapter.addDevice(&lamp);
+    return level.getValue().integer;
+}
+
+void testRemoveSavesPendingValues()
+{
+    sim::reset();
+    remove(STORE_PATH);
+    ThingStore store(STORE_PATH);
+    TinyAdapter adapter("tunnel-1", 443, "/ws");
+    ThingDevice lamp("lamp", lampTypes);
+    ThingProperty level("level", INTEGER, "LevelProperty");
+    level.persistent = true;
+    lamp.addProperty(&level);
+    adapter.setStore(&store);
+    adapter.addDevice(&lamp);
+
+    // removed within the debounce window
+    setLevel(level, 7);
+    adapter.update();
+    adapter.removeDevice(&lamp);
+    CHECK(restoredLevel("lamp") == 7);
+}
+
+void testCompactionKeepsRemovedThings()
+{
+    sim::reset();
+    remove(STORE_PATH);
+    ThingStore store(STORE_PATH);
+    TinyAdapter adapter("tunnel-1", 443, "/ws");
+    ThingDevice lamp("lamp", lampTypes);
+    ThingDevice heater("heater", lampTypes);
+    ThingProperty lampLevel("level", INTEGER, "LevelProperty");
+    ThingProperty heaterLevel("level", INTEGER, "LevelProperty");
+    lampLevel.persistent = true;
+    heaterLevel.persistent = true;
+    lamp.addProperty(&lampLevel);
+    heater.addProperty(&heaterLevel);
+    adapter.setStore(&store);
+    adapter.addDevice(&lamp);
+    adapter.addDevice(&heater);
+
+    for (int i = 1; i <= 3; i++)
+    {
+        setLevel(heaterLevel, 20 + i);
+        settle(adapter);
+    }
+    adapter.removeDevice(&heater);
+
+    // grow the log past THING_STORE_COMPACT_SIZE so it is compacted
+    for (int i = 0; i < 400; i++)
+    {
+        setLevel(lampLevel, i);
+        settle(adapter);
+    }
+    long size = fileSize(STORE_PATH);
+    printf("  log is %ld bytes\n", size);
+    CHECK(size < THING_STORE_COMPACT_SIZE);
+    CHECK(restoredLevel("heater") == 23);
+    CHECK(restoredLevel("lamp") == 399);
+}
+
+void testLargeStoreIsNotRewrittenOnEveryWrite()
+{
+    sim::reset();
+    remove(STORE_PATH);
+    ThingStore store(STORE_PATH);
+    TinyAdapter adapter("tunnel-1", 443, "/ws");
+    adapter.setStore(&store);
+
+    // live records alone take more than THING_STORE_COMPACT_SIZE
+    std::vector<ThingDevice *> lamps;
+    std::vector<ThingProperty *> levels;
+    for (int i = 0; i < 300; i++)
+    {
+        String id = "lamp-" + String(i);
+        ThingDevice *lamp = new ThingDevice(id.c_str(), lampTypes);
+        ThingProperty *level = new ThingProperty("level", INTEGER, "LevelProperty");
+        level->persistent = true;
+        lamp->addProperty(level);
+        adapter.addDevice(lamp);
+        setLevel(*level, i);
+        lamps.push_back(lamp);
+        levels.push_back(level);
+    }
+    settle(adapter);
+    long compacted = fileSize(STORE_PATH);
+    printf("  %d things take %ld bytes\n", (int)lamps.size(), compacted);
+    CHECK(compacted > THING_STORE_COMPACT_SIZE);
+
+    // single changes are appended, not followed by a full rewrite
+    for (int i = 0; i < 10; i++)
+    {
+        setLevel(*levels[i], 1000 + i);
+        settle(adapter);
+    }
+    long grown = fileSize(STORE_PATH);
+    CHECK(grown > compacted);
+
+    // until the log doubled
+    for (int i = 0; grown <= 2 * compacted && i < 1000; i++)
+    {
+        setLevel(*levels[i % levels.size()], 2000 + i);
+        settle(adapter);
+        long size = fileSize(STORE_PATH);
+        if (size < grown)
+        {
+            break;
+        }
+        grown = size;
+    }
+    long size = fileSize(STORE_PATH);
+    CHECK(size < 2 * compacted);
+    CHECK(restoredLevel("lamp-299") == levels[299]->getValue().integer);
+
+    for (size_t i = 0; i < lamps.size(); i++)
+    {
+        delete lamps[i];
+        delete levels[i];
+    }
+}
+
+void testTornRecordIsDropped()
+{
+    sim::reset();
+    remove(STORE_PATH);
+    appendLevel("lamp", 5);
+    appendLevel("lamp", 6);
+    long good = fileSize(STORE_PATH);
+    // power lost in the middle of the next write
+    appendLevel("lamp", 7, 9);
+    CHECK(fileSize(STORE_PATH) == good + 9);
+
+    ThingStore store(STORE_PATH);
+    CHECK(store.begin());
+    CHECK(fileSize(STORE_PATH) == good);
+    CHECK(restoredLevel("lamp") == 6);
+}
+
+void testCorruptRecordIsDropped()
+{
+    sim::reset();
+    remove(STORE_PATH);
+    appendLevel("lamp", 5);
+    appendLevel("lamp", 6);
+    long good = fileSize(STORE_PATH);
+    appendLevel("lamp", 7);
+
+    // flip a bit of the last value
+    FILE *log = fopen(STORE_PATH, "r+");
+    fseek(log, -2, SEEK_END);
+    int byte = fgetc(log);
+    fseek(log, -2, SEEK_END);
+    fputc(byte ^ 0x01, log);
+    fclose(log);
+
+    ThingStore store(STORE_PATH);
+    CHECK(store.begin());
+    CHECK(fileSize(STORE_PATH) == good);
+    CHECK(restoredLevel("lamp") == 6);
+}
+
+void testMismatchedRecordsAreIgnored()
+{
+    sim::reset();
+    remove(STORE_PATH);
+    appendLevel("lamp", 6);
+    // valid records the property can't take: other type, other length
+    bool on = true;
+    appendRecord(BOOLEAN, "lamp", "level", &on, sizeof(on));
+    int32_t level = 7;
+    appendRecord(INTEGER, "lamp", "level", &level, sizeof(level));
+    long size = fileSize(STORE_PATH);
+
+    CHECK(restoredLevel("lamp") == 6);
+    CHECK(fileSize(STORE_PATH) == size);
+}
+
+void testReAddKeepsLiveValues()
+{
+    sim::reset();
+    remove(STORE_PATH);
+    ThingStore store(STORE_PATH);
+    TinyAdapter adapter("tunnel-1", 443, "/ws");
+    ThingDevice lamp("lamp", lampTypes);
+    ThingProperty level("level", INTEGER, "LevelProperty", countCallback);
+    level.persistent = true;
+    lamp.addProperty(&level);
+    adapter.setStore(&store);
+
+    setLevel(level, 5);
+    adapter.addDevice(&lamp);
+    settle(adapter);
+    adapter.removeDevice(&lamp);
+
+    // changed while removed, e.g. by a local button
+    setLevel(level, 9);
+    callbacks = 0;
+    adapter.addDevice(&lamp);
+    CHECK(level.getValue().integer == 9);
+    CHECK(callbacks == 0);
+}
+
+void testDuplicateIdsAreRejected()
+{
+    sim::reset();
+    TinyAdapter adapter("tunnel-1", 443, "/ws");
+    ThingDevice lamp("lamp", lampTypes);
+    ThingDevice other("lamp", lampTypes);
+    CHECK(adapter.addDevice(&lamp));
+    CHECK(!adapter.addDevice(&lamp));
+    CHECK(!adapter.addDevice(&other));
+    CHECK(adapter.firstDevice == &lamp && adapter.lastDevice == &lamp);
+    CHECK(lamp.next == nullptr);
+}
+
+int main()
+{
+    RUN(testRemoveSavesPendingValues);
+    RUN(testCompactionKeepsRemovedThings);
+    RUN(testLargeStoreIsNotRewrittenOnEveryWrite);
+    RUN(testTornRecordIsDropped);
+    RUN(testCorruptRecordIsDropped);
+    RUN(testMismatchedRecordsAreIgnored);
+    RUN(testReAddKeepsLiveValues);
+    RUN(testDuplicateIdsAreRejected);
+    remove(STORE_PATH);
+    remove(STORE_PATH ".tmp");
+    return checkFailures == 0 ? 0 : 1;
+}